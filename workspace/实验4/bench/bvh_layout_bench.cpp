@@ -0,0 +1,141 @@
+// 大网格上二叉BVH与压缩4叉BVH的比较：每个三角形占用的内存（遍历时访问的节点和三角形数据），
+// 以及最近交点和遮挡测试的吞吐量。网格是细分的凹凸球面，三角形数由命令行给出
+#include "CompressedBVH.h"
+#include "Random.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+// 约triangle_count个三角形的凹凸球面，法线朝外
+static std::vector<Triange> make_bumpy_sphere(uint32_t triangle_count) {
+    uint32_t rings = std::max((uint32_t)sqrtf(triangle_count / 4.0f), 2u), segments = 2 * rings;
+    auto vertex = [&](uint32_t ring, uint32_t segment) {
+        float theta = (float)M_PI * ring / rings, phi = 2 * (float)M_PI * segment / segments;
+        float r = 1 + 0.05f * sinf(12 * theta) * sinf(9 * phi);
+        return vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * r;
+    };
+    std::vector<Triange> triangles;
+    for (uint32_t ring = 0; ring < rings; ring++) {
+        for (uint32_t segment = 0; segment < segments; segment++) {
+            vec3 a = vertex(ring, segment), b = vertex(ring, segment + 1);
+            vec3 c = vertex(ring + 1, segment + 1), d = vertex(ring + 1, segment);
+            // 两极处退化的三角形不要
+            if (ring > 0)
+                triangles.emplace_back(a, b, c, 0);
+            if (ring + 1 < rings)
+                triangles.emplace_back(c, d, a, 0);
+        }
+    }
+    return triangles;
+}
+
+// 球面外的随机点指向球心附近的随机点，target为目标点
+static void make_rays(uint32_t count, std::vector<Ray> &rays, std::vector<float> &lengths) {
+    PCG32 rng(3, 5);
+    auto in_ball = [&](float radius) {
+        vec3 p;
+        do {
+            p = vec3(rng.next_float(), rng.next_float(), rng.next_float()) * 2.0f - vec3(1, 1, 1);
+        } while (dot(p, p) > 1);
+        return p * radius;
+    };
+    for (uint32_t i = 0; i < count; i++) {
+        vec3 start = normalize(in_ball(1)) * 3.0f, target = in_ball(1.2f);
+        rays.emplace_back(start, target - start);
+        lengths.push_back(length(target - start));
+    }
+}
+
+// 所有光线执行一遍fn的吞吐量（百万条光线每秒），重复rounds次取最快的
+template <typename Fn> static double throughput(const std::vector<Ray> &rays, int rounds, Fn &&fn) {
+    float best_ms = FLT_MAX;
+    for (int round = 0; round < rounds; round++) {
+        Clock clock;
+        for (size_t i = 0; i < rays.size(); i++)
+            fn(i);
+        best_ms = std::min(best_ms, clock.get_current_delta());
+    }
+    return rays.size() / (best_ms * 1e3);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t triangle_count = argc > 1 ? (uint32_t)std::stoul(argv[1]) : 1u << 20;
+    uint32_t ray_count = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 1u << 19;
+    int rounds = argc > 3 ? std::stoi(argv[3]) : 3;
+
+    std::vector<Triange> triangles = make_bumpy_sphere(triangle_count);
+    std::vector<AABB> boxes;
+    for (const auto &triangle : triangles)
+        boxes.push_back(triangle.get_bounds());
+    BVH bvh;
+    bvh.build(boxes, BVH_BINNED_SAH);
+    Clock clock;
+    CompressedBVH compressed;
+    if (!compressed.build(bvh, triangles)) {
+        std::cerr << "The binary BVH has a leaf too large to compress" << std::endl;
+        return 1;
+    }
+    float compress_ms = clock.get_current_delta();
+
+    // 二叉BVH遍历时访问节点、叶子中的下标和完整的三角形；压缩BVH只访问节点和叶子中的紧凑三角形，
+    // 总大小包括构造交点用的材质和uv_lod数组，网格压缩后不再保留完整的三角形
+    double n = (double)triangles.size();
+    size_t binary_nodes = bvh.node_count() * sizeof(BVHNode);
+    size_t binary_total = bvh.get_size_bytes() + triangles.size() * sizeof(Triange);
+    size_t compressed_nodes = compressed.node_count() * sizeof(CompressedBVHNode);
+    size_t compressed_total = compressed.get_size_bytes();
+    std::cout << triangles.size() << " triangles, " << ray_count << " rays" << std::endl;
+    std::cout << "binary:     " << bvh.node_count() << " nodes, " << binary_nodes / n << " B/tri in nodes, "
+              << binary_total / n << " B/tri total (" << binary_total / (1 << 20) << "MB)" << std::endl;
+    std::cout << "compressed: " << compressed.node_count() << " nodes, " << compressed_nodes / n << " B/tri in nodes, "
+              << compressed_total / n << " B/tri total (" << compressed_total / (1 << 20) << "MB), built in "
+              << compress_ms << "ms from the binary BVH" << std::endl;
+
+    std::vector<Ray> rays;
+    std::vector<float> lengths;
+    make_rays(ray_count, rays, lengths);
+
+    // 与Mesh::distance相同的二叉BVH遍历
+    auto binary_closest = [&](const Ray &ray, uint32_t &triangle) {
+        float best = -1;
+        bvh.closest(ray, FLT_MAX, [&](uint32_t i) {
+            float s = triangles[i].distance(ray);
+            if (s > 0 && (best < 0 || s < best || (s == best && i < triangle))) {
+                best = s;
+                triangle = i;
+            }
+            return best < 0 ? FLT_MAX : best;
+        });
+        return best;
+    };
+
+    // 两种布局使用同一个三角形求交方法，结果应当完全相同
+    size_t differ = 0, hits = 0;
+    for (const Ray &ray : rays) {
+        uint32_t a = UINT32_MAX, slot = 0;
+        float sa = binary_closest(ray, a), sb = compressed.closest(ray, FLT_MAX, slot);
+        hits += sa > 0;
+        differ += (sa > 0) != (sb > 0) || (sa > 0 && (sa != sb || a != compressed.triangle_index(slot)));
+    }
+    std::cout << hits << " rays hit, " << differ << " differ between layouts" << std::endl;
+
+    double sum = 0;
+    uint32_t triangle = 0;
+    double binary_closest_mrays = throughput(rays, rounds, [&](size_t i) { sum += binary_closest(rays[i], triangle); });
+    double compressed_closest_mrays =
+        throughput(rays, rounds, [&](size_t i) { sum += compressed.closest(rays[i], FLT_MAX, triangle); });
+    double binary_any_mrays = throughput(rays, rounds, [&](size_t i) {
+        sum += bvh.any(rays[i], lengths[i], [&](uint32_t k) { return triangles[k].occludes(rays[i], lengths[i]); });
+    });
+    double compressed_any_mrays =
+        throughput(rays, rounds, [&](size_t i) { sum += compressed.any(rays[i], lengths[i]); });
+    std::cout << "closest: binary " << binary_closest_mrays << " MRays/s, compressed " << compressed_closest_mrays
+              << " MRays/s" << std::endl;
+    std::cout << "any:     binary " << binary_any_mrays << " MRays/s, compressed " << compressed_any_mrays
+              << " MRays/s (checksum " << sum << ")" << std::endl;
+    return 0;
+}
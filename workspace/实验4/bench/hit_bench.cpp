@@ -0,0 +1,174 @@
+// 求最近交点的基准：比较遍历时为每个候选图元构造完整Hit（原来的做法）与
+// 只比较距离、最后为最近的图元构造一次Hit（Scene::firstIntersect）的每条光线用时。
+// 光线为实验4场景的主光线，以及从主光线交点出发的随机方向的二次光线
+#include "Random.h"
+#include "clock.h"
+#include "scene.h"
+
+#include <algorithm>
+#include <float.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// 每条光线求交的图元数（实例内部的三角形也计入）和原来的做法构造Hit的次数
+struct CandidateStats {
+    uint64_t tested = 0, constructed = 0;
+};
+
+// 原来的图元求交：返回完整的Hit。三角形的求交没有分支，不相交时也填写交点信息；球和平面只在相交时填写
+static Hit eager_primitive(const Sphere &sphere, const Ray &ray, CandidateStats *stats) {
+    Hit hit;
+    hit.s = sphere.distance(ray);
+    if (hit.s > 0) {
+        sphere.finalize_hit(ray, hit);
+        stats->constructed++;
+    }
+    stats->tested++;
+    return hit;
+}
+static Hit eager_primitive(const Plane &plane, const Ray &ray, CandidateStats *stats) {
+    Hit hit;
+    hit.s = plane.distance(ray);
+    if (hit.s >= 0) {
+        plane.finalize_hit(ray, hit);
+        stats->constructed++;
+    }
+    stats->tested++;
+    return hit;
+}
+static Hit eager_primitive(const Triange &triangle, const Ray &ray, CandidateStats *stats) {
+    Hit hit;
+    hit.s = triangle.distance(ray);
+    triangle.finalize_hit(ray, hit);
+    stats->tested++;
+    stats->constructed++;
+    return hit;
+}
+
+// 距离更近时整个Hit复制到best
+static void eager_update(Hit &best, uint32_t &best_id, const Hit &hit, uint32_t id, float t_max = FLT_MAX) {
+    if (hit.s > 0 && hit.s <= t_max && (best.s < 0 || hit.s < best.s || (hit.s == best.s && id < best_id))) {
+        best = hit;
+        best_id = id;
+    }
+}
+
+// 原来的实例求交：网格内每个三角形都构造Hit，最近的交点再变换回世界空间
+static Hit eager_instance(const PrimitiveStore &prims, const Instance &instance, const Ray &ray, float t_max,
+                          CandidateStats *stats) {
+    const Mesh &mesh = prims.meshes[instance.mesh];
+    Ray object_ray = instance.to_object(ray);
+    Hit best;
+    uint32_t best_id = 0;
+    mesh.bvh.closest(object_ray, t_max, [&](uint32_t i) {
+        eager_update(best, best_id, eager_primitive(mesh.triangles[i], object_ray, stats), i, t_max);
+        return best.s < 0 ? t_max : best.s;
+    });
+    if (best.s < 0)
+        return best;
+    best.position = ray.start + ray.dir * best.s;
+    best.normal = normalize(transform_normal(best.normal, instance.world_to_object));
+    best.uv_lod += instance.lod_bias;
+    return best;
+}
+
+// 原来的最近交点：遍历时每个候选图元都构造完整的Hit，距离更近时整个复制
+static Hit eager_intersect(const PrimitiveStore &prims, const BVH &bvh, const Ray &ray, CandidateStats &stats) {
+    thread_ray_count++; // 与firstIntersect一样统计光线数
+    Hit best;
+    uint32_t best_id = 0;
+    for (uint32_t i = 0; i < prims.planes.size(); i++)
+        eager_update(best, best_id, eager_primitive(prims.planes[i], ray, &stats), make_primitive_ref(PRIM_PLANE, i));
+    bvh.closest(ray, [&](uint32_t id) {
+        uint32_t index = primitive_index(id);
+        switch (primitive_type(id)) {
+        case PRIM_SPHERE:
+            eager_update(best, best_id, eager_primitive(prims.spheres[index], ray, &stats), id);
+            break;
+        case PRIM_TRIANGLE:
+            eager_update(best, best_id, eager_primitive(prims.triangles[index], ray, &stats), id);
+            break;
+        default:
+            eager_update(best, best_id,
+                         eager_instance(prims, prims.instances[index], ray, best.s < 0 ? FLT_MAX : best.s, &stats), id);
+            break;
+        }
+        return best.s < 0 ? FLT_MAX : best.s;
+    });
+    if (dot(ray.dir, best.normal) > 0)
+        best.normal = best.normal * (-1);
+    return best;
+}
+
+// 所有光线求交一遍的用时，返回每条光线的平均用时（纳秒）；checksum防止结果被优化掉
+template <typename Fn> static double time_rays(const std::vector<Ray> &rays, Fn &&fn, double &checksum) {
+    Clock clock;
+    for (const Ray &ray : rays) {
+        Hit hit = fn(ray);
+        checksum += hit.s + hit.position.x + hit.normal.y + hit.uv.x;
+    }
+    return clock.get_current_delta() * 1e6 / (double)rays.size();
+}
+
+static void bench(const char *name, const std::vector<Ray> &rays, int rounds) {
+    const PrimitiveStore &prims = scene.get_primitives();
+    const BVH &bvh = scene.get_bvh();
+    // 两种做法的结果应完全相同
+    size_t mismatches = 0;
+    CandidateStats stats, unused;
+    for (const Ray &ray : rays) {
+        Hit a = eager_intersect(prims, bvh, ray, stats), b = scene.firstIntersect(ray);
+        bool same_surface = a.position == b.position && a.normal == b.normal && a.material == b.material;
+        if (a.s != b.s || (a.s > 0 && !same_surface))
+            mismatches++;
+    }
+    // 两种做法交替运行，各取最快的一轮，减小其他进程的干扰
+    auto eager = [&](const Ray &ray) { return eager_intersect(prims, bvh, ray, unused); };
+    auto lazy = [&](const Ray &ray) { return scene.firstIntersect(ray); };
+    double checksum = 0, eager_ns = DBL_MAX, lazy_ns = DBL_MAX;
+    for (int round = 0; round < rounds; round++) {
+        eager_ns = std::min(eager_ns, time_rays(rays, eager, checksum));
+        lazy_ns = std::min(lazy_ns, time_rays(rays, lazy, checksum));
+    }
+    size_t count = rays.size();
+    std::cout << name << ": " << count << " rays, " << (double)stats.tested / count << " primitive tests/ray, "
+              << (double)stats.constructed / count << " eager Hit constructions/ray" << std::endl;
+    std::cout << "  eager " << eager_ns << " ns/ray, lazy " << lazy_ns << " ns/ray, saving " << (eager_ns - lazy_ns)
+              << " ns/ray (" << (1 - lazy_ns / eager_ns) * 100 << "%), mismatches " << mismatches << " (checksum "
+              << checksum << ")"
+              << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t size = argc > 1 ? (uint32_t)std::stoul(argv[1]) : 512;
+    int rounds = argc > 2 ? std::stoi(argv[2]) : 10;
+
+    scene.set_resolution(size, size);
+    scene.build();
+    scene.set_print_stats(false);
+
+    std::vector<Ray> primary, secondary;
+    PCG32 rng(7, 1);
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            Ray ray = scene.primary_ray(x, y);
+            primary.push_back(ray);
+            Hit hit = scene.firstIntersect(ray);
+            if (hit.s < 0)
+                continue;
+            // 交点法线一侧的半球内均匀取一个方向
+            vec3 dir;
+            do {
+                dir = vec3(rng.next_float(), rng.next_float(), rng.next_float()) * 2.0f - vec3(1, 1, 1);
+            } while (dot(dir, dir) > 1 || dot(dir, dir) < 1e-6f);
+            if (dot(dir, hit.normal) < 0)
+                dir = dir * (-1);
+            secondary.emplace_back(hit.position + hit.normal * epsilon, dir);
+        }
+    }
+
+    bench("primary", primary, rounds);
+    bench("secondary", secondary, rounds);
+    return 0;
+}
@@ -0,0 +1,65 @@
+// 采样器的收敛基准：用路径追踪渐进渲染场景，统计每种采样器在1, 2, 4, ...个样本时与参考图像的RMSE。
+// 参考图像用另一个种子的Sobol序列渲染更多样本，与被测序列不相关
+#include "scene.h"
+
+#include <iostream>
+#include <math.h>
+#include <string>
+#include <vector>
+
+static double rmse(const std::vector<vec4> &image, const std::vector<vec4> &reference) {
+    double sum = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        vec4 d = image[i] - reference[i];
+        sum += d.x * d.x + d.y * d.y + d.z * d.z;
+    }
+    return sqrt(sum / (image.size() * 3));
+}
+
+// 从头累积count个样本，每到2的幂时调用on_spp(spp, image)
+template <typename Callback>
+static void render_samples(const Sampler &sampler, uint32_t count, std::vector<vec4> &image, Callback &&on_spp) {
+    scene.set_sampler(sampler);
+    scene.set_progressive(true);
+    for (uint32_t spp = 1; spp <= count; spp++) {
+        scene.render(image);
+        if ((spp & (spp - 1)) == 0)
+            on_spp(spp, image);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t size = argc > 1 ? (uint32_t)std::stoul(argv[1]) : 128;
+    uint32_t max_spp = argc > 2 ? (uint32_t)std::stoul(argv[2]) : 256;
+    uint32_t reference_spp = argc > 3 ? (uint32_t)std::stoul(argv[3]) : 4 * max_spp;
+
+    scene.set_resolution(size, size);
+    scene.build();
+    scene.set_print_stats(false);
+    scene.set_integrator(INTEGRATOR_PATH);
+
+    std::vector<vec4> reference;
+    render_samples(Sampler(SAMPLER_SOBOL, 0x5eed), reference_spp, reference, [](uint32_t, const std::vector<vec4> &) {});
+    std::cout << size << "x" << size << ", reference " << reference_spp << " spp" << std::endl;
+
+    const SamplerType types[] = {SAMPLER_INDEPENDENT, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE};
+    std::vector<std::vector<double>> errors;
+    for (SamplerType type : types) {
+        std::vector<vec4> image;
+        errors.emplace_back();
+        render_samples(Sampler(type), max_spp, image,
+                       [&](uint32_t, const std::vector<vec4> &result) { errors.back().push_back(rmse(result, reference)); });
+    }
+
+    std::cout << "spp";
+    for (SamplerType type : types)
+        std::cout << "\t" << Sampler::get_name(type);
+    std::cout << std::endl;
+    for (size_t i = 0; i < errors[0].size(); i++) {
+        std::cout << (1u << i);
+        for (const auto &column : errors)
+            std::cout << "\t" << column[i];
+        std::cout << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+// 线程池任务开销的微基准：提交10^6个空任务，统计每个任务的平均开销
+#include "SThreadPool.h"
+#include "clock.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+
+static const int task_count = 1000000;
+
+// 只测任务类型本身：构造、移动一次（相当于入队和出队）、执行
+template <typename TaskType> static float bench_task_type(void *a, void *b, void *c) {
+    Clock clock;
+    for (int i = 0; i < task_count; i++) {
+        TaskType task([a, b, c, i] { (void)a, (void)b, (void)c, (void)i; });
+        TaskType dequeued = std::move(task);
+        dequeued();
+    }
+    return clock.get_current_delta() * 1e6f / task_count;
+}
+
+int main(int argc, char *argv[]) {
+    size_t thread_num = argc > 1 ? (size_t)std::stoi(argv[1]) : 0;
+    int dummy[3];
+
+    float function_ns = bench_task_type<std::function<void()>>(&dummy[0], &dummy[1], &dummy[2]);
+    float task_ns = bench_task_type<SThreadPool::Task>(&dummy[0], &dummy[1], &dummy[2]);
+    std::cout << "std::function:     " << function_ns << " ns/task" << std::endl;
+    std::cout << "SThreadPool::Task: " << task_ns << " ns/task" << std::endl;
+
+    // 任务体为空，捕获和渲染任务差不多大小的数据
+    SThreadPool::ThreadPool pool(thread_num);
+    void *a = &dummy[0], *b = &dummy[1], *c = &dummy[2];
+    for (int round = 0; round < 3; round++) {
+        Clock clock;
+        for (int i = 0; i < task_count; i++)
+            pool.add_task([a, b, c, i] { (void)a, (void)b, (void)c, (void)i; });
+        pool.wait_for_all_done();
+        float ms = clock.get_current_delta();
+        std::cout << "pool: " << task_count << " empty tasks in " << ms << "ms, " << ms * 1e6f / task_count
+                  << " ns/task" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,362 @@
+#include "AccelCache.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <type_traits>
+
+#ifdef _WIN32
+#include "winapi.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// 缓存中的数组都是按字节原样写出的
+static_assert(std::is_trivially_copyable<Triange>::value, "Triange is stored as raw bytes");
+static_assert(std::is_trivially_copyable<BVHNode>::value, "BVHNode is stored as raw bytes");
+static_assert(std::is_trivially_copyable<CompressedBVHNode>::value, "CompressedBVHNode is stored as raw bytes");
+static_assert(std::is_trivially_copyable<CompactTriangle>::value, "CompactTriangle is stored as raw bytes");
+static_assert(std::is_trivially_copyable<mat4>::value, "mat4 is stored as raw bytes");
+
+static const char cache_magic[8] = {'R', 'T', 'A', 'C', 'C', 'E', 'L', '\0'};
+// 每个数组按缓存行对齐
+static const uint64_t cache_alignment = 64;
+
+// 数组在文件中的位置和元素个数
+struct ArrayRecord {
+    uint64_t offset, count;
+};
+
+struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t mesh_count;
+    uint64_t key;
+    uint64_t file_size;
+    ArrayRecord instance_meshes, instance_transforms;
+};
+
+// 紧跟在文件头后面，每个网格一个
+struct MeshRecord {
+    AABB bounds;
+    BVHBuildStats stats;
+    ArrayRecord triangles, vertex_indices, normals, uvs;
+    ArrayRecord bvh_nodes, bvh_indices;
+    ArrayRecord compressed_nodes, compact_triangles, compact_materials, compact_uv_lods;
+};
+
+//---------------------------
+// 只读映射整个文件，析构时解除映射
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_READONLY, NULL);
+        LARGE_INTEGER file_size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+            return;
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL)
+            return;
+        ptr = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (ptr != nullptr)
+            length = (size_t)file_size.QuadPart;
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ptr = (const char *)p;
+                length = (size_t)st.st_size;
+            }
+        }
+        // 映射建立后可以关闭文件
+        close(fd);
+#endif
+    }
+    ~MappedFile() {
+#ifdef _WIN32
+        if (ptr != nullptr)
+            UnmapViewOfFile(ptr);
+        if (mapping != NULL)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (ptr != nullptr)
+            munmap((void *)ptr, length);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const char *ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE, mapping = NULL;
+#endif
+};
+
+// 64位哈希，每次吸收8个字节。只用于判断缓存是否过期，不需要抗碰撞
+static uint64_t hash_bytes(const char *data, size_t size, uint64_t h) {
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = (h ^ word) * multiplier;
+        h ^= h >> 32;
+    }
+    for (; i < size; i++)
+        h = (h ^ (uint8_t)data[i]) * multiplier;
+    return (h ^ size) * multiplier;
+}
+
+static uint64_t hash_value(uint64_t value, uint64_t h) { return hash_bytes((const char *)&value, sizeof(value), h); }
+
+uint64_t AccelCache::make_key(const std::vector<std::string> &files, uint64_t params) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    // 构建参数和存放的类型的大小，改了其中任何一个都要重新构建
+    for (uint64_t value : {(uint64_t)version, (uint64_t)Mesh::compressed_min_triangles, (uint64_t)BVH::max_leaf_size,
+                           (uint64_t)BVH::bin_count, (uint64_t)BVH::max_depth, (uint64_t)sizeof(Triange),
+                           (uint64_t)sizeof(MeshRecord), (uint64_t)sizeof(BVHNode), (uint64_t)sizeof(CompressedBVHNode),
+                           (uint64_t)sizeof(CompactTriangle), params})
+        h = hash_value(value, h);
+    for (const std::string &file : files) {
+        MappedFile mapped(file);
+        h = hash_bytes(mapped.data(), mapped.size(), h);
+    }
+    return h;
+}
+
+//---------------------------
+
+bool AccelCache::valid_mesh(const Mesh &mesh) {
+    size_t triangle_count = mesh.triangle_count();
+    if (!mesh.vertex_indices.empty() && mesh.vertex_indices.size() != 3 * triangle_count)
+        return false;
+    for (uint32_t v : mesh.vertex_indices)
+        if ((!mesh.normals.empty() && v >= mesh.normals.size()) || (!mesh.uvs.empty() && v >= mesh.uvs.size()))
+            return false;
+
+    // build总是先放父节点再放子节点，所以子节点的下标必须比父节点大，每个节点只能有一个父节点。
+    // 按下标顺序检查时父节点的深度已经确定，这样既排除了环，也保证遍历栈不会溢出
+    const BVH &bvh = mesh.bvh;
+    for (uint32_t index : bvh.indices)
+        if (index >= mesh.triangles.size())
+            return false;
+    std::vector<uint32_t> depths(bvh.nodes.size(), UINT32_MAX);
+    if (!depths.empty())
+        depths[0] = 0;
+    for (size_t i = 0; i < bvh.nodes.size(); i++) {
+        const BVHNode &node = bvh.nodes[i];
+        if (node.count > 0) {
+            if (node.first > bvh.indices.size() || node.count > bvh.indices.size() - node.first)
+                return false;
+            continue;
+        }
+        if (node.first <= i || node.first + 1 >= bvh.nodes.size() || depths[i] >= BVH::max_depth ||
+            depths[node.first] != UINT32_MAX || depths[node.first + 1] != UINT32_MAX)
+            return false;
+        depths[node.first] = depths[node.first + 1] = depths[i] + 1;
+    }
+
+    const CompressedBVH &compressed = mesh.compressed;
+    size_t compact_count = compressed.triangles.size();
+    if (compressed.materials.size() != compact_count || compressed.uv_lods.size() != compact_count)
+        return false;
+    for (const CompactTriangle &triangle : compressed.triangles)
+        if (triangle.index >= compact_count)
+            return false;
+    depths.assign(compressed.nodes.size(), UINT32_MAX);
+    if (!depths.empty())
+        depths[0] = 0;
+    for (size_t i = 0; i < compressed.nodes.size(); i++) {
+        const CompressedBVHNode &node = compressed.nodes[i];
+        for (uint32_t k = 0; k < 4; k++) {
+            uint32_t child = node.child[k];
+            if (!(node.flags & (0x10 << k)))
+                continue;
+            if (node.flags & (1 << k)) {
+                if (child > compact_count || node.count[k] > compact_count - child)
+                    return false;
+                continue;
+            }
+            if (child <= i || child >= compressed.nodes.size() || depths[i] >= BVH::max_depth ||
+                depths[child] != UINT32_MAX)
+                return false;
+            depths[child] = depths[i] + 1;
+        }
+    }
+    return true;
+}
+
+bool AccelCache::read(const std::string &path, uint64_t key, vector<Mesh> &meshes,
+                      vector<std::pair<uint32_t, mat4>> &instances) {
+    MappedFile file(path);
+    const char *data = file.data();
+    size_t size = file.size();
+    if (size < sizeof(CacheHeader))
+        return false;
+    CacheHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != version ||
+        header.key != key || header.file_size != size ||
+        header.mesh_count > (size - sizeof(CacheHeader)) / sizeof(MeshRecord))
+        return false;
+
+    // 数组必须按缓存行对齐，并完整地落在文件内
+    auto valid = [&](const ArrayRecord &array, size_t element_size) {
+        return array.offset % cache_alignment == 0 && array.offset <= size &&
+               array.count <= (size - array.offset) / element_size;
+    };
+    // 整个数组一次复制出来，每个数组只分配一次内存
+    auto load = [&](const ArrayRecord &array, auto &out) {
+        using T = typename std::decay_t<decltype(out)>::value_type;
+        const T *first = (const T *)(data + array.offset);
+        out.assign(first, first + array.count);
+    };
+
+    std::vector<MeshRecord> records(header.mesh_count);
+    if (!records.empty())
+        memcpy(records.data(), data + sizeof(CacheHeader), records.size() * sizeof(MeshRecord));
+    if (!valid(header.instance_meshes, sizeof(uint32_t)) || !valid(header.instance_transforms, sizeof(mat4)) ||
+        header.instance_meshes.count != header.instance_transforms.count)
+        return false;
+    for (const MeshRecord &record : records) {
+        if (!valid(record.triangles, sizeof(Triange)) || !valid(record.vertex_indices, sizeof(uint32_t)) ||
+            !valid(record.normals, sizeof(vec3)) || !valid(record.uvs, sizeof(vec2)) ||
+            !valid(record.bvh_nodes, sizeof(BVHNode)) || !valid(record.bvh_indices, sizeof(uint32_t)) ||
+            !valid(record.compressed_nodes, sizeof(CompressedBVHNode)) ||
+            !valid(record.compact_triangles, sizeof(CompactTriangle)) ||
+            !valid(record.compact_materials, sizeof(uint32_t)) || !valid(record.compact_uv_lods, sizeof(float)))
+            return false;
+    }
+
+    vector<Mesh> loaded(records.size());
+    for (size_t i = 0; i < records.size(); i++) {
+        const MeshRecord &record = records[i];
+        Mesh &mesh = loaded[i];
+        mesh.bounds = record.bounds;
+        load(record.triangles, mesh.triangles);
+        load(record.vertex_indices, mesh.vertex_indices);
+        load(record.normals, mesh.normals);
+        load(record.uvs, mesh.uvs);
+        load(record.bvh_nodes, mesh.bvh.nodes);
+        load(record.bvh_indices, mesh.bvh.indices);
+        mesh.bvh.stats = record.stats;
+        load(record.compressed_nodes, mesh.compressed.nodes);
+        load(record.compact_triangles, mesh.compressed.triangles);
+        load(record.compact_materials, mesh.compressed.materials);
+        load(record.compact_uv_lods, mesh.compressed.uv_lods);
+        if (!valid_mesh(mesh))
+            return false;
+    }
+    std::vector<uint32_t> instance_meshes;
+    std::vector<mat4> instance_transforms;
+    load(header.instance_meshes, instance_meshes);
+    load(header.instance_transforms, instance_transforms);
+    for (uint32_t mesh : instance_meshes)
+        if (mesh >= loaded.size())
+            return false;
+
+    meshes = std::move(loaded);
+    instances.clear();
+    for (size_t i = 0; i < instance_meshes.size(); i++)
+        instances.emplace_back(instance_meshes[i], instance_transforms[i]);
+    return true;
+}
+
+bool AccelCache::write(const std::string &path, uint64_t key, const vector<Mesh> &meshes,
+                       const vector<std::pair<uint32_t, mat4>> &instances) {
+    std::vector<uint32_t> instance_meshes;
+    std::vector<mat4> instance_transforms;
+    for (const auto &[mesh, transform] : instances) {
+        instance_meshes.push_back(mesh);
+        instance_transforms.push_back(transform);
+    }
+
+    // 先排好所有数组在文件中的位置，再依次写出
+    struct Blob {
+        const void *data;
+        uint64_t offset, bytes;
+    };
+    std::vector<Blob> blobs;
+    uint64_t end = sizeof(CacheHeader) + meshes.size() * sizeof(MeshRecord);
+    auto place = [&](const auto &array) {
+        end = (end + cache_alignment - 1) / cache_alignment * cache_alignment;
+        ArrayRecord record = {end, array.size()};
+        uint64_t bytes = array.size() * sizeof(array[0]);
+        blobs.push_back({array.data(), end, bytes});
+        end += bytes;
+        return record;
+    };
+
+    CacheHeader header = {};
+    memcpy(header.magic, cache_magic, sizeof(cache_magic));
+    header.version = version;
+    header.mesh_count = (uint32_t)meshes.size();
+    header.key = key;
+    header.instance_meshes = place(instance_meshes);
+    header.instance_transforms = place(instance_transforms);
+    std::vector<MeshRecord> records(meshes.size());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        const Mesh &mesh = meshes[i];
+        MeshRecord &record = records[i];
+        record.bounds = mesh.bounds;
+        record.stats = mesh.bvh.stats;
+        record.triangles = place(mesh.triangles);
+        record.vertex_indices = place(mesh.vertex_indices);
+        record.normals = place(mesh.normals);
+        record.uvs = place(mesh.uvs);
+        record.bvh_nodes = place(mesh.bvh.nodes);
+        record.bvh_indices = place(mesh.bvh.indices);
+        record.compressed_nodes = place(mesh.compressed.nodes);
+        record.compact_triangles = place(mesh.compressed.triangles);
+        record.compact_materials = place(mesh.compressed.materials);
+        record.compact_uv_lods = place(mesh.compressed.uv_lods);
+    }
+    header.file_size = end;
+
+    // 临时文件名带上进程号，同时写同一个缓存的几个进程不会互相覆盖写了一半的文件
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    std::string temp_path = path + "." + std::to_string(pid) + ".tmp";
+    FILE *file = fopen(temp_path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    if (!records.empty())
+        ok = ok && fwrite(records.data(), sizeof(MeshRecord), records.size(), file) == records.size();
+    uint64_t written = sizeof(CacheHeader) + records.size() * sizeof(MeshRecord);
+    static const char padding[cache_alignment] = {};
+    for (const Blob &blob : blobs) {
+        ok = ok && fwrite(padding, 1, blob.offset - written, file) == blob.offset - written;
+        if (blob.bytes > 0)
+            ok = ok && fwrite(blob.data, 1, blob.bytes, file) == blob.bytes;
+        written = blob.offset + blob.bytes;
+    }
+    ok = fclose(file) == 0 && ok;
+#ifdef _WIN32
+    // Windows上rename不能覆盖已有的文件
+    remove(path.c_str());
+#endif
+    if (!ok || rename(temp_path.c_str(), path.c_str()) != 0) {
+        remove(temp_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "PrimitiveStore.h"
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+//---------------------------
+// 加速结构的磁盘缓存：网格的三角形、顶点属性、建好的BVH（或压缩BVH）和实例原样写进一个二进制文件。
+// 下次启动时用mmap映射该文件，每个数组整块复制出来，不再解析模型、也不再构建BVH。
+// 文件头中有版本号和键，键是源文件内容与构建参数的哈希，任何一个变化都会使缓存失效
+class AccelCache {
+public:
+    // 文件格式或网格的构建算法改变时增加
+    static const uint32_t version = 2;
+
+    // 源文件（如.gltf和它引用的.bin）的内容、构建参数和调用者的其他参数params（如材质）的哈希
+    static uint64_t make_key(const std::vector<std::string> &files, uint64_t params);
+    // 读取缓存。文件不存在、版本或键不符、大小不对或内容损坏时返回false，meshes和instances不变
+    static bool read(const std::string &path, uint64_t key, vector<Mesh> &meshes,
+                     vector<std::pair<uint32_t, mat4>> &instances);
+    // 写入缓存，meshes必须已经build。先写临时文件再改名，中途失败不会留下不完整的缓存
+    static bool write(const std::string &path, uint64_t key, const vector<Mesh> &meshes,
+                      const vector<std::pair<uint32_t, mat4>> &instances);
+
+private:
+    // 读入的网格中所有下标都在范围内、树的深度不超过BVH::max_depth，损坏的文件不会导致越界访问
+    static bool valid_mesh(const Mesh &mesh);
+};
@@ -0,0 +1,476 @@
+#include "BVH.h"
+#include "SThreadPool.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <numeric>
+
+// 遍历一次内部节点相对于求交一个图元的代价
+static const float traversal_cost = 1.0f;
+// 图元数不超过这个值的子树不再拆分成并行任务
+static const uint32_t min_parallel_subtree = 256;
+
+// 包围盒稍微放大一点，避免slab测试的浮点误差漏掉恰好在盒子表面上的交点（比如轴对齐的墙面）
+static AABB padded(const AABB &box) {
+    float extent = fmaxf(fmaxf(fabsf(box.min.x), fabsf(box.max.x)),
+                         fmaxf(fmaxf(fabsf(box.min.y), fabsf(box.max.y)), fmaxf(fabsf(box.min.z), fabsf(box.max.z))));
+    float pad = 1e-5f * (1.0f + extent);
+    AABB result;
+    result.min = box.min - vec3(pad, pad, pad);
+    result.max = box.max + vec3(pad, pad, pad);
+    return result;
+}
+
+// 构建过程中用到的数据，子树之间只会访问indices中互不重叠的区间，因此可以并行构建
+struct BVHBuilder {
+    const std::vector<AABB> &boxes;
+    const std::vector<vec3> &centers;
+    std::vector<uint32_t> &indices;
+
+    // 划分完成后为node_index创建两个子节点，左子节点包含前split个图元
+    void make_children(std::vector<BVHNode> &nodes, uint32_t node_index, uint32_t split) {
+        const uint32_t first = nodes[node_index].first;
+        const uint32_t count = nodes[node_index].count;
+        BVHNode left, right;
+        left.first = first;
+        left.count = split;
+        right.first = first + split;
+        right.count = count - split;
+        for (uint32_t i = left.first; i < left.first + left.count; i++)
+            left.box.expand(boxes[indices[i]]);
+        for (uint32_t i = right.first; i < right.first + right.count; i++)
+            right.box.expand(boxes[indices[i]]);
+
+        uint32_t left_index = (uint32_t)nodes.size();
+        nodes.push_back(left);
+        nodes.push_back(right);
+        nodes[node_index].first = left_index;
+        nodes[node_index].count = 0;
+    }
+
+    // 是否值得划分，best_cost为两侧 表面积*图元数 之和
+    static bool should_split(const BVHNode &node, float best_cost) {
+        float parent_area = node.box.surface_area();
+        float split_cost = parent_area > 0 ? traversal_cost + best_cost / parent_area : (float)node.count;
+        return node.count > BVH::max_leaf_size || split_cost < (float)node.count;
+    }
+
+    //---------------------------
+    // 完整扫描：沿三个轴分别按中心排序，扫描所有划分位置，取SAH代价最小的
+    void sweep(std::vector<BVHNode> &nodes, uint32_t node_index, uint32_t depth) {
+        const uint32_t first = nodes[node_index].first;
+        const uint32_t count = nodes[node_index].count;
+        if (count <= 1 || depth >= BVH::max_depth)
+            return;
+
+        auto begin = indices.begin() + first;
+        auto end = begin + count;
+
+        std::vector<float> right_area(count);
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        uint32_t best_split = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            std::sort(begin, end, [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+            AABB right;
+            for (uint32_t i = count - 1; i > 0; i--) {
+                right.expand(boxes[indices[first + i]]);
+                right_area[i] = right.surface_area();
+            }
+            AABB left;
+            for (uint32_t i = 1; i < count; i++) {
+                left.expand(boxes[indices[first + i - 1]]);
+                float cost = left.surface_area() * i + right_area[i] * (count - i);
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+
+        if (!should_split(nodes[node_index], best_cost))
+            return;
+
+        if (best_axis != 2)
+            std::sort(begin, end, [&](uint32_t a, uint32_t b) { return centers[a][best_axis] < centers[b][best_axis]; });
+
+        make_children(nodes, node_index, best_split);
+        uint32_t left_index = nodes[node_index].first;
+        sweep(nodes, left_index, depth + 1);
+        sweep(nodes, left_index + 1, depth + 1);
+    }
+
+    //---------------------------
+    // 分桶：按中心所在的桶统计包围盒和数量，只在桶边界上求SAH代价。
+    // 划分成功时重排indices并返回左侧的图元数量，不值得划分时返回0
+    uint32_t binned_split(const BVHNode &node) {
+        const uint32_t first = node.first;
+        const uint32_t count = node.count;
+
+        AABB centroid_box;
+        for (uint32_t i = first; i < first + count; i++)
+            centroid_box.expand(centers[indices[i]]);
+
+        struct Bin {
+            AABB box;
+            uint32_t count = 0;
+        };
+        float best_cost = FLT_MAX;
+        int best_axis = -1;
+        uint32_t best_bin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            float lo = centroid_box.min[axis], extent = centroid_box.max[axis] - lo;
+            if (extent <= 0)
+                continue;
+            float scale = BVH::bin_count / extent;
+
+            Bin bins[BVH::bin_count];
+            for (uint32_t i = first; i < first + count; i++) {
+                uint32_t id = indices[i];
+                uint32_t b = std::min((uint32_t)((centers[id][axis] - lo) * scale), BVH::bin_count - 1);
+                bins[b].count++;
+                bins[b].box.expand(boxes[id]);
+            }
+
+            float right_area[BVH::bin_count];
+            uint32_t right_count[BVH::bin_count];
+            AABB right;
+            uint32_t n = 0;
+            for (uint32_t b = BVH::bin_count - 1; b > 0; b--) {
+                right.expand(bins[b].box);
+                n += bins[b].count;
+                right_area[b] = right.surface_area();
+                right_count[b] = n;
+            }
+            AABB left;
+            n = 0;
+            for (uint32_t b = 1; b < BVH::bin_count; b++) {
+                left.expand(bins[b - 1].box);
+                n += bins[b - 1].count;
+                if (n == 0 || right_count[b] == 0)
+                    continue;
+                float cost = left.surface_area() * n + right_area[b] * right_count[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        auto begin = indices.begin() + first;
+        auto end = begin + count;
+        if (best_axis < 0) {
+            // 所有中心重合，无法按位置划分，图元太多时从中间分开
+            return count > BVH::max_leaf_size ? count / 2 : 0;
+        }
+        if (!should_split(node, best_cost))
+            return 0;
+
+        float lo = centroid_box.min[best_axis];
+        float scale = BVH::bin_count / (centroid_box.max[best_axis] - lo);
+        auto mid = std::partition(begin, end, [&](uint32_t id) {
+            return std::min((uint32_t)((centers[id][best_axis] - lo) * scale), BVH::bin_count - 1) < best_bin;
+        });
+        return (uint32_t)(mid - begin);
+    }
+
+    void binned(std::vector<BVHNode> &nodes, uint32_t node_index, uint32_t depth) {
+        if (nodes[node_index].count <= 1 || depth >= BVH::max_depth)
+            return;
+        uint32_t split = binned_split(nodes[node_index]);
+        if (split == 0)
+            return;
+        make_children(nodes, node_index, split);
+        uint32_t left_index = nodes[node_index].first;
+        binned(nodes, left_index, depth + 1);
+        binned(nodes, left_index + 1, depth + 1);
+    }
+
+    // 并行构建的子树，根节点对应主节点数组中的node_index，构建时使用自己的节点数组
+    struct Subtree {
+        uint32_t node_index;
+        uint32_t depth;
+        std::vector<BVHNode> nodes;
+    };
+
+    // 在当前线程划分树的上层，直到子树足够小，把这些子树收集起来交给线程池
+    void binned_top(std::vector<BVHNode> &nodes, uint32_t node_index, uint32_t depth, uint32_t threshold,
+                    std::vector<Subtree> &subtrees) {
+        if (nodes[node_index].count <= threshold) {
+            subtrees.push_back({node_index, depth, {nodes[node_index]}});
+            return;
+        }
+        if (depth >= BVH::max_depth)
+            return;
+        uint32_t split = binned_split(nodes[node_index]);
+        if (split == 0)
+            return;
+        make_children(nodes, node_index, split);
+        uint32_t left_index = nodes[node_index].first;
+        binned_top(nodes, left_index, depth + 1, threshold, subtrees);
+        binned_top(nodes, left_index + 1, depth + 1, threshold, subtrees);
+    }
+
+    void binned_parallel(std::vector<BVHNode> &nodes, SThreadPool::ThreadPool &pool) {
+        uint32_t threshold = std::max(min_parallel_subtree, nodes[0].count / (uint32_t)(pool.thread_count() * 4));
+        std::vector<Subtree> subtrees;
+        binned_top(nodes, 0, 0, threshold, subtrees);
+
+        SThreadPool::parallel_for(pool, 0, subtrees.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                binned(subtrees[i].nodes, 0, subtrees[i].depth);
+        });
+
+        // 把子树的节点接到主节点数组后面，子树内部的下标加上偏移
+        for (auto &subtree : subtrees) {
+            uint32_t offset = (uint32_t)nodes.size() - 1;
+            for (size_t i = 0; i < subtree.nodes.size(); i++) {
+                BVHNode node = subtree.nodes[i];
+                if (node.count == 0)
+                    node.first += offset;
+                if (i == 0)
+                    nodes[subtree.node_index] = node;
+                else
+                    nodes.push_back(node);
+            }
+        }
+    }
+};
+
+void BVH::build(const std::vector<AABB> &boxes, BVHBuildMethod method, SThreadPool::ThreadPool *pool) {
+    Clock clock;
+    nodes.clear();
+    indices.resize(boxes.size());
+    std::iota(indices.begin(), indices.end(), 0);
+
+    if (!boxes.empty()) {
+        std::vector<AABB> padded_boxes(boxes.size());
+        std::vector<vec3> centers(boxes.size());
+        BVHNode root;
+        for (size_t i = 0; i < boxes.size(); i++) {
+            padded_boxes[i] = padded(boxes[i]);
+            centers[i] = boxes[i].center();
+            root.box.expand(padded_boxes[i]);
+        }
+        root.first = 0;
+        root.count = (uint32_t)boxes.size();
+
+        nodes.reserve(boxes.size() * 2);
+        nodes.push_back(root);
+        BVHBuilder builder{padded_boxes, centers, indices};
+        if (method == BVH_SWEEP_SAH)
+            builder.sweep(nodes, 0, 0);
+        else if (pool != nullptr)
+            builder.binned_parallel(nodes, *pool);
+        else
+            builder.binned(nodes, 0, 0);
+    }
+
+    // refit的数据在第一次refit时再建立
+    build_ids = indices;
+    primitive_ids.clear();
+    parents.clear();
+    leaf_of.clear();
+    costs.clear();
+    built_costs.clear();
+    free_pairs.clear();
+
+    stats.method = method;
+    stats.build_ms = clock.get_current_delta();
+    stats.node_count = nodes.size();
+    stats.sah_cost = sah_cost();
+}
+
+float BVH::sah_cost() const {
+    if (nodes.empty())
+        return 0;
+    double cost = 0;
+    for (const auto &node : nodes)
+        cost += node.box.surface_area() * (node.count == 0 ? traversal_cost : (float)node.count);
+    float root_area = nodes[0].box.surface_area();
+    return root_area > 0 ? (float)(cost / root_area) : 0;
+}
+
+//---------------------------
+// refit
+
+void BVH::prepare_refit() {
+    parents.assign(nodes.size(), UINT32_MAX);
+    leaf_of.assign(build_ids.size(), 0);
+    costs.assign(nodes.size(), 0);
+    // 构建时子节点总是排在父节点后面，倒序计算即可先算出子树的代价
+    for (uint32_t i = (uint32_t)nodes.size(); i-- > 0;) {
+        const BVHNode &node = nodes[i];
+        if (node.count > 0) {
+            for (uint32_t k = node.first; k < node.first + node.count; k++)
+                leaf_of[build_ids[k]] = i;
+            costs[i] = node.box.surface_area() * node.count;
+        } else {
+            parents[node.first] = parents[node.first + 1] = i;
+            costs[i] = node.box.surface_area() * traversal_cost + costs[node.first] + costs[node.first + 1];
+        }
+    }
+    built_costs = costs;
+}
+
+void BVH::refit_node(uint32_t index, const std::function<AABB(uint32_t)> &get_bounds) {
+    BVHNode &node = nodes[index];
+    node.box = AABB();
+    if (node.count > 0) {
+        for (uint32_t k = node.first; k < node.first + node.count; k++)
+            node.box.expand(padded(get_bounds(build_ids[k])));
+        costs[index] = node.box.surface_area() * node.count;
+    } else {
+        node.box.expand(nodes[node.first].box);
+        node.box.expand(nodes[node.first + 1].box);
+        costs[index] = node.box.surface_area() * traversal_cost + costs[node.first] + costs[node.first + 1];
+    }
+    refit_stats.refitted_nodes++;
+}
+
+void BVH::rebuild_subtree(uint32_t root, const std::function<AABB(uint32_t)> &get_bounds) {
+    // 子树中的图元在indices中是连续的一段；原来的节点对都放回空闲列表
+    uint32_t begin = UINT32_MAX, end = 0;
+    size_t freed = free_pairs.size();
+    std::vector<uint32_t> stack(1, root);
+    while (!stack.empty()) {
+        const BVHNode &node = nodes[stack.back()];
+        stack.pop_back();
+        if (node.count > 0) {
+            begin = std::min(begin, node.first);
+            end = std::max(end, node.first + node.count);
+            continue;
+        }
+        free_pairs.push_back(node.first);
+        stack.push_back(node.first);
+        stack.push_back(node.first + 1);
+    }
+    // 空闲的节点包围盒为空，不参与SAH代价，也不会被访问到
+    for (size_t i = freed; i < free_pairs.size(); i++) {
+        for (uint32_t k = free_pairs[i]; k < free_pairs[i] + 2; k++) {
+            nodes[k] = BVHNode{AABB(), 0, 0};
+            parents[k] = UINT32_MAX;
+            costs[k] = built_costs[k] = 0;
+        }
+    }
+
+    // 用子树自己的图元数组构建，与并行构建子树相同
+    uint32_t count = end - begin;
+    std::vector<AABB> boxes(count);
+    std::vector<vec3> centers(count);
+    std::vector<uint32_t> local(count);
+    BVHNode local_root;
+    for (uint32_t j = 0; j < count; j++) {
+        AABB box = get_bounds(build_ids[begin + j]);
+        boxes[j] = padded(box);
+        centers[j] = box.center();
+        local_root.box.expand(boxes[j]);
+        local[j] = j;
+    }
+    local_root.first = 0;
+    local_root.count = count;
+    std::vector<BVHNode> local_nodes(1, local_root);
+    uint32_t depth = 0;
+    for (uint32_t p = root; parents[p] != UINT32_MAX; p = parents[p])
+        depth++;
+    BVHBuilder builder{boxes, centers, local};
+    builder.binned(local_nodes, 0, depth);
+
+    std::vector<uint32_t> old_ids(build_ids.begin() + begin, build_ids.begin() + end);
+    for (uint32_t j = 0; j < count; j++) {
+        build_ids[begin + j] = old_ids[local[j]];
+        indices[begin + j] = primitive_id(build_ids[begin + j]);
+    }
+
+    // 局部的节点对(2p + 1, 2p + 2)放到空闲的节点对，没有空闲的再追加到数组末尾
+    std::vector<uint32_t> slots(local_nodes.size());
+    slots[0] = root;
+    for (size_t i = 1; i < local_nodes.size(); i += 2) {
+        uint32_t pair;
+        if (!free_pairs.empty()) {
+            pair = free_pairs.back();
+            free_pairs.pop_back();
+        } else {
+            pair = (uint32_t)nodes.size();
+            nodes.resize(nodes.size() + 2);
+            parents.resize(nodes.size());
+            costs.resize(nodes.size());
+            built_costs.resize(nodes.size());
+        }
+        slots[i] = pair;
+        slots[i + 1] = pair + 1;
+    }
+    // 局部节点的子节点总是排在后面，倒序写回可以先算出子树的代价
+    for (size_t i = local_nodes.size(); i-- > 0;) {
+        BVHNode node = local_nodes[i];
+        uint32_t index = slots[i];
+        if (node.count > 0) {
+            node.first += begin;
+            for (uint32_t k = node.first; k < node.first + node.count; k++)
+                leaf_of[build_ids[k]] = index;
+            costs[index] = node.box.surface_area() * node.count;
+        } else {
+            node.first = slots[node.first];
+            parents[node.first] = parents[node.first + 1] = index;
+            costs[index] = node.box.surface_area() * traversal_cost + costs[node.first] + costs[node.first + 1];
+        }
+        nodes[index] = node;
+        built_costs[index] = costs[index];
+    }
+    refit_stats.rebuilt_subtrees++;
+    refit_stats.rebuilt_primitives += count;
+}
+
+void BVH::refit(const std::vector<uint32_t> &moved, const std::function<AABB(uint32_t)> &get_bounds,
+                SThreadPool::ThreadPool *pool) {
+    Clock clock;
+    refit_stats = BVHRefitStats();
+    refit_stats.moved = (uint32_t)moved.size();
+    if (nodes.empty() || moved.empty())
+        return;
+    if (parents.empty())
+        prepare_refit();
+
+    // 从每个移动的图元所在的叶子向上更新到根
+    for (uint32_t id : moved)
+        for (uint32_t node = leaf_of[id]; node != UINT32_MAX; node = parents[node])
+            refit_node(node, get_bounds);
+
+    // 每条路径上代价变差太多的最高的节点。两条路径选出的节点要么相同，要么互不包含
+    std::vector<uint32_t> degraded;
+    for (uint32_t id : moved) {
+        uint32_t highest = UINT32_MAX;
+        for (uint32_t node = leaf_of[id]; node != UINT32_MAX; node = parents[node])
+            if (costs[node] > refit_rebuild_ratio * built_costs[node])
+                highest = node;
+        if (highest != UINT32_MAX && std::find(degraded.begin(), degraded.end(), highest) == degraded.end())
+            degraded.push_back(highest);
+    }
+
+    // 根节点也变差了，或者重建子树留下的空闲节点太多时，整棵树重建
+    bool root_degraded = std::find(degraded.begin(), degraded.end(), 0u) != degraded.end();
+    if (root_degraded || free_pairs.size() * 2 > nodes.size() / 2) {
+        std::vector<AABB> boxes(build_ids.size());
+        for (uint32_t i = 0; i < boxes.size(); i++)
+            boxes[i] = get_bounds(i);
+        std::vector<uint32_t> ids = std::move(primitive_ids);
+        build(boxes, stats.method, pool);
+        if (!ids.empty())
+            remap_primitives(ids);
+        refit_stats.full_rebuild = true;
+        refit_stats.rebuilt_primitives = (uint32_t)boxes.size();
+    } else {
+        for (uint32_t root : degraded) {
+            rebuild_subtree(root, get_bounds);
+            for (uint32_t node = parents[root]; node != UINT32_MAX; node = parents[node])
+                refit_node(node, get_bounds);
+        }
+        float root_area = nodes[0].box.surface_area();
+        stats.sah_cost = root_area > 0 ? costs[0] / root_area : 0;
+        stats.node_count = nodes.size() - free_pairs.size() * 2;
+    }
+    refit_stats.refit_ms = clock.get_current_delta();
+}
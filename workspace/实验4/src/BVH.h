@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Intersectable.h"
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+namespace SThreadPool {
+class ThreadPool;
+}
+
+//---------------------------
+// BVH节点，count为0时是内部节点，两个子节点为nodes[first]和nodes[first + 1]；
+// 否则是叶子节点，包含indices[first, first + count)中的图元
+struct BVHNode {
+    AABB box;
+    uint32_t first;
+    uint32_t count;
+};
+
+// 构建方法
+enum BVHBuildMethod {
+    BVH_SWEEP_SAH, // 每个节点沿三个轴排序，扫描所有划分位置，质量最好但最慢
+    BVH_BINNED_SAH // 把图元中心分到若干个桶里只在桶边界上划分，子树分给线程池并行构建
+};
+
+// 构建统计
+struct BVHBuildStats {
+    BVHBuildMethod method = BVH_SWEEP_SAH;
+    float build_ms = 0;  // 构建用时
+    size_t node_count = 0;
+    float sah_cost = 0;  // 整棵树的SAH代价，用于比较不同构建方法的质量
+};
+
+// 上一次refit的统计
+struct BVHRefitStats {
+    float refit_ms = 0;
+    uint32_t moved = 0;              // 移动的图元数
+    uint32_t refitted_nodes = 0;     // 重新计算包围盒的节点数（同一节点可能被多条路径重复计算）
+    uint32_t rebuilt_subtrees = 0;   // SAH代价变差太多而重建的子树数
+    uint32_t rebuilt_primitives = 0; // 这些子树中的图元数
+    bool full_rebuild = false;       // 根节点也变差太多，或者空闲节点太多时整棵树重建
+};
+
+//---------------------------
+// 层次包围盒，使用表面积启发式(SAH)构建
+class BVH {
+public:
+    // 叶子节点最多包含的图元数量
+    static const uint32_t max_leaf_size = 4;
+    // 超过这个深度直接生成叶子，保证遍历栈不会溢出
+    static const uint32_t max_depth = 48;
+    // 分桶构建时每个轴的桶数
+    static const uint32_t bin_count = 32;
+    // refit后子树的SAH代价超过建立时的这个倍数就重建该子树
+    static constexpr float refit_rebuild_ratio = 1.5f;
+
+    // 根据每个图元的包围盒建立BVH，图元用其在boxes中的下标表示。
+    // 分桶构建时如果给了线程池，足够小的子树会作为任务并行构建
+    void build(const std::vector<AABB> &boxes, BVHBuildMethod method = BVH_SWEEP_SAH,
+               SThreadPool::ThreadPool *pool = nullptr);
+
+    const BVHBuildStats &get_stats() const { return stats; }
+    // 计算整棵树的SAH代价（相对根节点表面积归一化）
+    float sah_cost() const;
+
+    // 把叶子中引用的图元下标i替换为ids[i]，refit时仍按build时的下标指定图元
+    void remap_primitives(const std::vector<uint32_t> &ids) {
+        for (auto &index : indices)
+            index = ids[index];
+        primitive_ids = ids;
+    }
+
+    // 图元移动后的增量更新：moved为移动了的图元（build时的下标），get_bounds(i)返回图元i现在的包围盒。
+    // 从moved所在的叶子向上逐层重新计算包围盒，子树的SAH代价变差超过refit_rebuild_ratio倍时
+    // 用分桶SAH重建这棵子树，只移动少数图元时代价与树的深度成正比。整棵树重建时与build一样使用线程池pool
+    void refit(const std::vector<uint32_t> &moved, const std::function<AABB(uint32_t)> &get_bounds,
+               SThreadPool::ThreadPool *pool = nullptr);
+    const BVHRefitStats &get_refit_stats() const { return refit_stats; }
+
+    bool empty() const { return nodes.empty(); }
+    size_t node_count() const { return nodes.size(); }
+    size_t get_size_bytes() const { return nodes.size() * sizeof(BVHNode) + indices.size() * sizeof(uint32_t); }
+
+    // 最近交点遍历：visit(prim)对图元求交，返回当前已知的最近交点距离（无交点返回t_max），
+    // 进入距离大于该值的节点会被跳过
+    template <typename Visitor> void closest(const Ray &ray, Visitor &&visit) const {
+        closest(ray, FLT_MAX, visit);
+    }
+    template <typename Visitor> void closest(const Ray &ray, float t_max, Visitor &&visit) const {
+        if (nodes.empty())
+            return;
+        vec3 inv_dir = safe_inverse(ray.dir);
+        uint32_t stack[64];
+        uint32_t top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            float t_near;
+            if (!node.box.intersect(ray.start, inv_dir, t_max, t_near))
+                continue;
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                    t_max = visit(indices[i]);
+                continue;
+            }
+            // 先访问近的子节点，远的后入栈
+            float t_left, t_right;
+            bool hit_left = nodes[node.first].box.intersect(ray.start, inv_dir, t_max, t_left);
+            bool hit_right = nodes[node.first + 1].box.intersect(ray.start, inv_dir, t_max, t_right);
+            if (hit_left && hit_right) {
+                if (t_left <= t_right) {
+                    stack[top++] = node.first + 1;
+                    stack[top++] = node.first;
+                } else {
+                    stack[top++] = node.first;
+                    stack[top++] = node.first + 1;
+                }
+            } else if (hit_left) {
+                stack[top++] = node.first;
+            } else if (hit_right) {
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+    // 光线包的最近交点遍历：只要包中有一条光线与节点相交就进入该节点。
+    // visit(prim)对图元求交，返回每条光线当前的最近交点距离
+    template <typename Visitor> void closest(const RayPacket &packet, vfloat t_max, Visitor &&visit) const {
+        if (nodes.empty())
+            return;
+        uint32_t stack[64];
+        uint32_t top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            vfloat t_near;
+            if (movemask(node.box.intersect(packet, t_max, t_near)) == 0)
+                continue;
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                    t_max = visit(indices[i]);
+                continue;
+            }
+            // 按包中相交光线的最小进入距离排序，先访问近的子节点
+            vfloat t_left, t_right;
+            int hit_left = movemask(nodes[node.first].box.intersect(packet, t_max, t_left));
+            int hit_right = movemask(nodes[node.first + 1].box.intersect(packet, t_max, t_right));
+            if (hit_left && hit_right) {
+                if (packet_min(t_left, hit_left) <= packet_min(t_right, hit_right)) {
+                    stack[top++] = node.first + 1;
+                    stack[top++] = node.first;
+                } else {
+                    stack[top++] = node.first;
+                    stack[top++] = node.first + 1;
+                }
+            } else if (hit_left) {
+                stack[top++] = node.first;
+            } else if (hit_right) {
+                stack[top++] = node.first + 1;
+            }
+        }
+    }
+
+    // 任意交点遍历：visit(prim)返回true表示找到交点，立即结束。进入距离不小于t_max的节点会被跳过
+    template <typename Visitor> bool any(const Ray &ray, float t_max, Visitor &&visit) const {
+        if (nodes.empty())
+            return false;
+        vec3 inv_dir = safe_inverse(ray.dir);
+        uint32_t stack[64];
+        uint32_t top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BVHNode &node = nodes[stack[--top]];
+            float t_near;
+            if (!node.box.intersect(ray.start, inv_dir, t_max, t_near))
+                continue;
+            if (node.count > 0) {
+                for (uint32_t i = node.first; i < node.first + node.count; i++)
+                    if (visit(indices[i]))
+                        return true;
+                continue;
+            }
+            stack[top++] = node.first + 1;
+            stack[top++] = node.first;
+        }
+        return false;
+    }
+
+private:
+    // mask中有效分量的最小值
+    static float packet_min(vfloat v, int mask) {
+        float values[PACKET_SIZE];
+        v.store(values);
+        float result = FLT_MAX;
+        for (int i = 0; i < PACKET_SIZE; i++)
+            if (mask & (1 << i))
+                result = std::min(result, values[i]);
+        return result;
+    }
+
+    // refit用到的数据，第一次refit时才建立
+    void prepare_refit();
+    // 节点的包围盒和子树SAH代价由子节点重新计算，叶子由图元的包围盒计算
+    void refit_node(uint32_t node, const std::function<AABB(uint32_t)> &get_bounds);
+    // 在原位置重建以node为根的子树，新的节点优先使用空闲的节点对
+    void rebuild_subtree(uint32_t node, const std::function<AABB(uint32_t)> &get_bounds);
+    // build时下标为i的图元在indices中的值
+    uint32_t primitive_id(uint32_t i) const { return primitive_ids.empty() ? i : primitive_ids[i]; }
+
+    std::vector<BVHNode> nodes;
+    std::vector<uint32_t> indices; // 叶子节点引用的图元下标
+    BVHBuildStats stats;
+
+    std::vector<uint32_t> primitive_ids; // remap_primitives的映射，为空表示没有映射
+    std::vector<uint32_t> build_ids;     // indices中每个位置的图元在build时的下标
+    std::vector<uint32_t> parents;       // 每个节点的父节点，根节点为UINT32_MAX
+    std::vector<uint32_t> leaf_of;       // 每个图元（build时的下标）所在的叶子
+    std::vector<float> costs;            // 每个节点子树的SAH代价（未归一化）
+    std::vector<float> built_costs;      // 子树建立时的SAH代价
+    std::vector<uint32_t> free_pairs;    // 重建子树后不再使用的节点对（两个相邻节点中的第一个）
+    BVHRefitStats refit_stats;
+
+    friend struct BVHBuilder;
+    friend class CompressedBVH;
+    friend class AccelCache;
+};
@@ -2,6 +2,7 @@
 #include <GL/glew.h>
 #include <GL/glut.h>
 #include "scene.h"
+#include "DynamicResolution.h"
 
 #include <iostream>
 #include <vector>
@@ -27,17 +28,21 @@ public:
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
 
-    // 加载纹理（光线追踪计算结果image作为纹理）
-    void LoadTexture(vector<vec4> &image) {
+    // 加载纹理（光线追踪计算结果image作为纹理），分辨率低于窗口时由线性过滤放大
+    void LoadTexture(vector<vec4> &image, uint32_t width, uint32_t height) {
         // 绑定纹理
         glBindTexture(GL_TEXTURE_2D, textureId);
         // 加载纹理（光线追踪计算颜色image）到纹理内存（to GPU）
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, windowWidth, windowHeight, 0, GL_RGBA, GL_FLOAT, &image[0]); // To GPU
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, &image[0]); // To GPU
     }
 };
 
 FullScreenTexturedQuad *fullScreenTexturedQuad;
 
+// 相机移动时的动态分辨率
+DynamicResolution dynamic_resolution;
+uint32_t last_view_revision = 0;
+
 //---------------------------
 // 整个函数的初始化，设定视窗、初始化场景、初始化着色器，并创建gpu进程
 void onInitialization() {
@@ -78,7 +83,13 @@ void onDisplay() {
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    vector<vec4> image(windowWidth * windowHeight);
+    vector<vec4> image;
+
+    // 视点变化时按帧时间预算降低分辨率，停止后恢复全分辨率
+    bool moving = scene.get_view_revision() != last_view_revision;
+    last_view_revision = scene.get_view_revision();
+    dynamic_resolution.update(moving, scene.get_frame_ms());
+    scene.set_resolution(dynamic_resolution.scaled(windowWidth), dynamic_resolution.scaled(windowHeight));
 
     // 场景绘制（通过光线追踪计算所有像素值，保存在image中）
     scene.render(image);
@@ -87,7 +98,7 @@ void onDisplay() {
     // glDrawPixels(windowWidth, windowHeight, GL_RGBA, GL_FLOAT, &image[0]);
 
     // 把光线追踪计算的image作为场景纹理
-    fullScreenTexturedQuad->LoadTexture(image);
+    fullScreenTexturedQuad->LoadTexture(image, scene.get_width(), scene.get_height());
 
     // 绘制纹理
     glBegin(GL_POLYGON);
@@ -106,6 +117,10 @@ void onDisplay() {
     glEnd();
 
     glutSwapBuffers();
+
+    // 降低分辨率的帧之后再画一帧，相机已经停止时会恢复全分辨率
+    if (scene.get_width() != windowWidth || scene.get_height() != windowHeight)
+        glutPostRedisplay();
 }
 
 void onReshape(int w, int h) {
@@ -124,19 +139,81 @@ void onReshape(int w, int h) {
     timebase = glutGet(GLUT_ELAPSED_TIME);
 }
 
+static bool rotating = true; // 相机是否在绕场景旋转
+
 void onIdle() {
     // 视点旋转
-    long time = glutGet(GLUT_ELAPSED_TIME);
-    scene.animate(0.001f * (time - time_last_frame));
+    if (rotating) {
+        long time = glutGet(GLUT_ELAPSED_TIME);
+        scene.animate(0.001f * (time - time_last_frame));
+    }
 
     glutPostRedisplay();
 }
 
+// 相机旋转或渐进渲染时需要不断重绘，否则只在事件发生时重绘
+static void update_idle_func() {
+    glutIdleFunc(rotating || scene.get_progressive() ? onIdle : NULL);
+}
+
 void onKeyboard(unsigned char key, int , int) {
-    if (key == '1')
-        glutIdleFunc(onIdle);
-    if (key == '2')
-        glutIdleFunc(NULL);
+    if (key == '1') {
+        rotating = true;
+        update_idle_func();
+    }
+    if (key == '2') {
+        rotating = false;
+        update_idle_func();
+    }
+
+    // 切换贴图过滤：最近点/双线性/三线性
+    if (key == 'f')
+        scene.set_texture_filter((TextureFilter)((scene.get_texture_filter() + 1) % 3));
+
+    // 动态分辨率的开关和帧时间预算
+    if (key == 'r')
+        dynamic_resolution.set_enabled(!dynamic_resolution.get_enabled());
+    if (key == '+' || key == '-') {
+        dynamic_resolution.set_budget_ms(dynamic_resolution.get_budget_ms() + (key == '+' ? 5.0f : -5.0f));
+        cout << "frame budget: " << dynamic_resolution.get_budget_ms() << "ms" << endl;
+    }
+
+    // 切换渐进渲染：视点不动时持续累积样本
+    if (key == 'a') {
+        scene.set_progressive(!scene.get_progressive());
+        update_idle_func();
+    }
+
+    // 切换Whitted光线追踪/路径追踪，路径追踪需要渐进渲染才能收敛，切换时一并打开
+    if (key == 'g') {
+        bool path = scene.get_integrator() == INTEGRATOR_WHITTED;
+        scene.set_integrator(path ? INTEGRATOR_PATH : INTEGRATOR_WHITTED);
+        if (path && !scene.get_progressive()) {
+            scene.set_progressive(true);
+            update_idle_func();
+        }
+    }
+
+    // 切换点光源的采样方式：光源BVH抽样/遍历全部
+    if (key == 'l')
+        scene.set_light_sampling(scene.get_light_sampling() == LIGHTS_BVH ? LIGHTS_EXACT : LIGHTS_BVH);
+
+    // 切换采样器：独立随机数/Sobol/蓝噪声
+    if (key == 'n') {
+        SamplerType type = (SamplerType)((scene.get_sampler().get_type() + 1) % 3);
+        scene.set_sampler(Sampler(type));
+        cout << "sampler: " << Sampler::get_name(type) << endl;
+    }
+
+    // 切换光线包/逐条追踪主光线
+    if (key == 'p')
+        scene.set_packet_tracing(!scene.get_packet_tracing());
+
+    // 切换分块顺序：逐行/Morton/螺旋
+    if (key == 't') {
+        TileScheduler &scheduler = scene.get_scheduler();
+        scheduler.set_order((TileOrder)((scheduler.get_order() + 1) % 3));
+    }
 
     if (key == 's') {
         long time = glutGet(GLUT_ELAPSED_TIME);
@@ -147,6 +224,8 @@ void onKeyboard(unsigned char key, int , int) {
         long time = glutGet(GLUT_ELAPSED_TIME);
         scene.zoomInOut(-0.05f * (time - time_last_frame));
     }
+
+    glutPostRedisplay();
 }
 
 //-----------------------------------------
@@ -0,0 +1,254 @@
+#include "CompressedBVH.h"
+
+#include <algorithm>
+#include <emmintrin.h>
+#include <math.h>
+#include <string.h>
+
+static_assert(sizeof(CompressedBVHNode) == 64, "CompressedBVHNode should fill one cache line");
+static_assert(sizeof(CompactTriangle) == 64, "CompactTriangle should fill one cache line");
+
+// 叶子节点在遍历栈中的标记，低2位是它在父节点中的位置，其余是父节点下标
+static const uint32_t leaf_bit = 0x80000000u;
+// 4叉树的深度不超过二叉树，每层最多多出3个待访问的子节点
+static const uint32_t max_stack = 256;
+
+// 2^e，e在[-126, 127]之间，直接拼出float的位模式
+static float exp2i(int e) {
+    uint32_t bits = (uint32_t)(e + 127) << 23;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+// 量化步长的指数：从origin开始255步能覆盖到max的最小指数
+static int8_t quantization_exponent(float origin, float max) {
+    float extent = max - origin;
+    int e = extent > 0 ? (int)ceilf(log2f(extent / 255)) : -126;
+    e = std::max(e, -126);
+    while (e < 127 && origin + 255 * exp2i(e) < max)
+        e++;
+    return (int8_t)e;
+}
+
+// 向外取整：反量化后的下界不大于lo，上界不小于hi。反量化的算式与遍历时相同
+static uint8_t quantize_lower(float lo, float origin, float scale) {
+    float q = std::min(std::max(floorf((lo - origin) / scale), 0.0f), 255.0f);
+    while (q > 0 && origin + q * scale > lo)
+        q--;
+    return (uint8_t)q;
+}
+static uint8_t quantize_upper(float hi, float origin, float scale) {
+    float q = std::min(std::max(ceilf((hi - origin) / scale), 0.0f), 255.0f);
+    while (q < 255 && origin + q * scale < hi)
+        q++;
+    return (uint8_t)q;
+}
+
+//---------------------------
+
+bool CompressedBVH::build(const BVH &bvh, const std::vector<Triange> &source) {
+    nodes.clear();
+    triangles.clear();
+    materials.clear();
+    uv_lods.clear();
+    if (bvh.empty())
+        return false;
+    for (const BVHNode &node : bvh.nodes)
+        if (node.count > UINT16_MAX)
+            return false;
+    triangles.reserve(bvh.indices.size());
+    materials.reserve(bvh.indices.size());
+    uv_lods.reserve(bvh.indices.size());
+    build_node(bvh, 0, source);
+    return true;
+}
+
+uint32_t CompressedBVH::build_node(const BVH &bvh, uint32_t binary_node, const std::vector<Triange> &source) {
+    // 从binary_node的两个子节点开始，反复把表面积最大的内部节点换成它的两个子节点，直到凑满4个
+    uint32_t children[4];
+    uint32_t child_count = 0;
+    const BVHNode &root = bvh.nodes[binary_node];
+    if (root.count > 0) {
+        children[child_count++] = binary_node; // 整棵树只有一个叶子
+    } else {
+        children[child_count++] = root.first;
+        children[child_count++] = root.first + 1;
+        while (child_count < 4) {
+            int widest = -1;
+            float widest_area = -1;
+            for (uint32_t i = 0; i < child_count; i++) {
+                const BVHNode &child = bvh.nodes[children[i]];
+                if (child.count == 0 && child.box.surface_area() > widest_area) {
+                    widest = (int)i;
+                    widest_area = child.box.surface_area();
+                }
+            }
+            if (widest < 0)
+                break;
+            uint32_t first = bvh.nodes[children[widest]].first;
+            children[widest] = first;
+            children[child_count++] = first + 1;
+        }
+    }
+
+    AABB box;
+    for (uint32_t i = 0; i < child_count; i++)
+        box.expand(bvh.nodes[children[i]].box);
+    CompressedBVHNode node = {};
+    for (int axis = 0; axis < 3; axis++) {
+        node.origin[axis] = box.min[axis];
+        node.exponent[axis] = quantization_exponent(box.min[axis], box.max[axis]);
+        float scale = exp2i(node.exponent[axis]);
+        for (uint32_t i = 0; i < child_count; i++) {
+            const AABB &child_box = bvh.nodes[children[i]].box;
+            node.lo[axis][i] = quantize_lower(child_box.min[axis], node.origin[axis], scale);
+            node.hi[axis][i] = quantize_upper(child_box.max[axis], node.origin[axis], scale);
+        }
+    }
+
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back(node);
+    for (uint32_t i = 0; i < child_count; i++) {
+        const BVHNode &child = bvh.nodes[children[i]];
+        node.flags |= 0x10 << i;
+        if (child.count == 0) {
+            node.child[i] = build_node(bvh, children[i], source);
+            continue;
+        }
+        // build已经检查过，叶子的三角形数不超过16位计数的范围
+        node.flags |= 1 << i;
+        node.child[i] = (uint32_t)triangles.size();
+        node.count[i] = (uint16_t)child.count;
+        for (uint32_t k = child.first; k < child.first + child.count; k++) {
+            const Triange &t = source[bvh.indices[k]];
+            triangles.push_back({t.v1, t.v3, t.normal, t.u_axis, t.v_axis, bvh.indices[k]});
+            materials.push_back(t.material);
+            uv_lods.push_back(t.uv_lod);
+        }
+    }
+    // 递归时nodes可能重新分配，子节点都建好后再写回
+    nodes[index] = node;
+    return index;
+}
+
+// 4个8位无符号整数转换成4个float
+static __m128 unpack_u8(const uint8_t *q) {
+    int32_t packed;
+    memcpy(&packed, q, sizeof(packed));
+    __m128i zero = _mm_setzero_si128();
+    __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+}
+
+int CompressedBVH::intersect_children(const CompressedBVHNode &node, const vec3 &start, const vec3 &inv_dir,
+                                      float t_max, float t_near[4]) {
+    // 与AABB::intersect相同的slab测试，4个子节点放在SSE寄存器的4个分量中一起算
+    __m128 t0 = _mm_set1_ps(-FLT_MAX), t1 = _mm_set1_ps(FLT_MAX);
+    for (int axis = 0; axis < 3; axis++) {
+        __m128 origin = _mm_set1_ps(node.origin[axis]), scale = _mm_set1_ps(exp2i(node.exponent[axis]));
+        __m128 lo = _mm_add_ps(origin, _mm_mul_ps(unpack_u8(node.lo[axis]), scale));
+        __m128 hi = _mm_add_ps(origin, _mm_mul_ps(unpack_u8(node.hi[axis]), scale));
+        __m128 s = _mm_set1_ps(start[axis]), inv = _mm_set1_ps(inv_dir[axis]);
+        __m128 ta = _mm_mul_ps(_mm_sub_ps(lo, s), inv), tb = _mm_mul_ps(_mm_sub_ps(hi, s), inv);
+        t0 = _mm_max_ps(t0, _mm_min_ps(ta, tb));
+        t1 = _mm_min_ps(t1, _mm_max_ps(ta, tb));
+    }
+    _mm_storeu_ps(t_near, t0);
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(t1, t0), _mm_cmpge_ps(t1, _mm_setzero_ps()));
+    hit = _mm_and_ps(hit, _mm_cmple_ps(t0, _mm_set1_ps(t_max)));
+    return _mm_movemask_ps(hit) & (node.flags >> 4);
+}
+
+float CompressedBVH::closest(const Ray &ray, float t_max, uint32_t &slot) const {
+    float best = -1;
+    uint32_t best_index = UINT32_MAX;
+    if (nodes.empty())
+        return best;
+    vec3 inv_dir = safe_inverse(ray.dir);
+    // 栈中保存节点和进入它的距离，出栈时如果已经找到更近的交点就跳过
+    struct Entry {
+        uint32_t ref;
+        float t;
+    };
+    Entry stack[max_stack];
+    uint32_t top = 0;
+    stack[top++] = {0, 0};
+    while (top > 0) {
+        Entry entry = stack[--top];
+        if (entry.t > t_max)
+            continue;
+        if (entry.ref & leaf_bit) {
+            const CompressedBVHNode &parent = nodes[(entry.ref & ~leaf_bit) >> 2];
+            uint32_t child = entry.ref & 3;
+            for (uint32_t k = parent.child[child]; k < parent.child[child] + parent.count[child]; k++) {
+                const CompactTriangle &t = triangles[k];
+                float s = triangle_distance(ray, t.v1, t.v3, t.normal, t.u_axis, t.v_axis);
+                // 与Mesh::distance相同，距离相同时取网格中下标小的三角形
+                if (s > 0 && s <= t_max && (best < 0 || s < best || (s == best && t.index < best_index))) {
+                    best = t_max = s;
+                    best_index = t.index;
+                    slot = k;
+                }
+            }
+            continue;
+        }
+
+        const CompressedBVHNode &node = nodes[entry.ref];
+        float t_near[4];
+        int mask = intersect_children(node, ray.start, inv_dir, t_max, t_near);
+        // 相交的子节点按距离从远到近排好，依次入栈，近的先出栈
+        Entry hits[4];
+        uint32_t count = 0;
+        for (uint32_t i = 0; i < 4; i++) {
+            if (!(mask & (1 << i)))
+                continue;
+            Entry child = {(node.flags & (1 << i)) ? leaf_bit | (entry.ref << 2) | i : node.child[i], t_near[i]};
+            uint32_t k = count++;
+            for (; k > 0 && hits[k - 1].t < child.t; k--)
+                hits[k] = hits[k - 1];
+            hits[k] = child;
+        }
+        for (uint32_t i = 0; i < count; i++)
+            stack[top++] = hits[i];
+    }
+    return best;
+}
+
+bool CompressedBVH::any(const Ray &ray, float t_max) const {
+    if (nodes.empty())
+        return false;
+    vec3 inv_dir = safe_inverse(ray.dir);
+    uint32_t stack[max_stack];
+    uint32_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        uint32_t ref = stack[--top];
+        if (ref & leaf_bit) {
+            const CompressedBVHNode &parent = nodes[(ref & ~leaf_bit) >> 2];
+            uint32_t slot = ref & 3;
+            for (uint32_t k = parent.child[slot]; k < parent.child[slot] + parent.count[slot]; k++) {
+                const CompactTriangle &t = triangles[k];
+                float s = triangle_distance(ray, t.v1, t.v3, t.normal, t.u_axis, t.v_axis);
+                if (s > 0 && s < t_max)
+                    return true;
+            }
+            continue;
+        }
+        const CompressedBVHNode &node = nodes[ref];
+        float t_near[4];
+        int mask = intersect_children(node, ray.start, inv_dir, t_max, t_near);
+        for (uint32_t i = 0; i < 4; i++)
+            if (mask & (1 << i))
+                stack[top++] = (node.flags & (1 << i)) ? leaf_bit | (ref << 2) | i : node.child[i];
+    }
+    return false;
+}
+
+void CompressedBVH::finalize_hit(uint32_t slot, const Ray &ray, Hit &hit) const {
+    const CompactTriangle &t = triangles[slot];
+    triangle_hit_point(ray, t.v3, t.u_axis, t.v_axis, hit);
+    hit.normal = t.normal;
+    hit.material = materials[slot];
+    hit.uv_lod = uv_lods[slot];
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "BVH.h"
+
+#include <stdint.h>
+#include <vector>
+
+//---------------------------
+// 压缩的4叉BVH节点，64字节，正好一个缓存行。子节点的包围盒相对本节点包围盒的最小角origin量化为8位整数，
+// 每个轴的步长为2^exponent：第i个子节点在该轴上的范围是origin + lo[axis][i] * 2^exponent到
+// origin + hi[axis][i] * 2^exponent，量化时向外取整，只会比原包围盒大
+struct CompressedBVHNode {
+    float origin[3];
+    uint32_t child[4];  // 内部节点为子节点在nodes中的下标，叶子为第一个三角形在triangles中的下标
+    uint16_t count[4];  // 叶子中的三角形数
+    int8_t exponent[3];
+    uint8_t flags;      // 低4位：第i个子节点是叶子；高4位：第i个子节点存在
+    uint8_t lo[3][4], hi[3][4];
+};
+
+// 叶子中的三角形，64字节：与Triange相同的求交数据（triangle_distance），边上的光线结果与二叉BVH一致；
+// 不保存v2，构造交点所需的材质和uv_lod在CompressedBVH的附加数组中。index为三角形在网格中的下标
+struct CompactTriangle {
+    vec3 v1, v3, normal, u_axis, v_axis;
+    uint32_t index;
+};
+
+//---------------------------
+// 压缩的宽BVH：由二叉BVH合并相邻层得到4叉树，子节点包围盒量化后存放，叶子中的三角形按遍历顺序连续存放，
+// 遍历和构造交点时都不再需要完整的三角形数组。占用的内存和带宽比二叉BVH加完整三角形少，适合很大的网格
+class CompressedBVH {
+public:
+    // 由已建好的二叉BVH构建，bvh中的图元下标即triangles中的下标
+    // 二叉BVH有叶子的三角形数超出16位计数（只可能在达到BVH::max_depth时出现）或为空时不压缩，返回false
+    bool build(const BVH &bvh, const std::vector<Triange> &triangles);
+
+    bool empty() const { return nodes.empty(); }
+    size_t node_count() const { return nodes.size(); }
+    size_t triangle_count() const { return triangles.size(); }
+    size_t get_size_bytes() const {
+        return nodes.size() * sizeof(CompressedBVHNode) +
+               triangles.size() * (sizeof(CompactTriangle) + sizeof(uint32_t) + sizeof(float));
+    }
+
+    // 最近交点：只考虑距离在(0, t_max]内的交点，距离相同时取网格中下标小的三角形。
+    // 返回交点距离，slot为命中的三角形在叶子数组中的位置；无交点返回负数
+    float closest(const Ray &ray, float t_max, uint32_t &slot) const;
+    // 是否有距离在(0, t_max)内的交点
+    bool any(const Ray &ray, float t_max) const;
+    // closest命中的三角形在网格中的下标
+    uint32_t triangle_index(uint32_t slot) const { return triangles[slot].index; }
+    // 由closest的结果构造交点，与Triange::finalize_hit相同
+    void finalize_hit(uint32_t slot, const Ray &ray, Hit &hit) const;
+
+private:
+    // 二叉BVH的节点binary_node及其下面的若干层合并成一个节点，返回新节点的下标
+    uint32_t build_node(const BVH &bvh, uint32_t binary_node, const std::vector<Triange> &source);
+    // 4个子节点包围盒的slab测试，返回相交子节点的掩码，t_near为进入各子节点的距离
+    static int intersect_children(const CompressedBVHNode &node, const vec3 &start, const vec3 &inv_dir, float t_max,
+                                  float t_near[4]);
+
+    std::vector<CompressedBVHNode> nodes;
+    std::vector<CompactTriangle> triangles;
+    std::vector<uint32_t> materials; // 与triangles一一对应
+    std::vector<float> uv_lods;
+
+    friend class AccelCache;
+};
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+
+//---------------------------
+// 动态分辨率：相机移动时降低渲染分辨率，使每帧用时接近预算，显示时由纹理过滤放大；
+// 相机停止后立即恢复全分辨率。渲染用时近似与像素数成正比，即与缩放比例的平方成正比
+class DynamicResolution {
+public:
+    void set_enabled(bool enable) { enabled = enable; }
+    bool get_enabled() const { return enabled; }
+    // 每帧的目标用时
+    void set_budget_ms(float ms) { budget_ms = std::max(ms, 1.0f); }
+    float get_budget_ms() const { return budget_ms; }
+    // 缩放比例的下限
+    void set_min_scale(float s) { min_scale = std::min(std::max(s, 0.01f), 1.0f); }
+
+    // 根据视点是否在变化和上一帧的用时（以上一帧的比例渲染）决定本帧的比例
+    void update(bool moving, float last_frame_ms) {
+        if (!enabled || !moving) {
+            scale = 1;
+            return;
+        }
+        if (last_frame_ms <= 0)
+            return;
+        // 上一帧按比例换算出的理想比例，和当前比例各取一半，避免用时抖动导致分辨率来回跳
+        float target = scale * sqrtf(budget_ms / last_frame_ms);
+        scale = std::min(std::max(0.5f * (scale + target), min_scale), 1.0f);
+    }
+
+    float get_scale() const { return scale; }
+    // 全分辨率为full时本帧的渲染分辨率
+    uint32_t scaled(uint32_t full) const { return std::max((uint32_t)(full * scale + 0.5f), 1u); }
+
+private:
+    bool enabled = true;
+    float budget_ms = 33;
+    float min_scale = 0.25f;
+    float scale = 1;
+};
@@ -0,0 +1,351 @@
+#include "GltfLoader.h"
+#include "Sjson.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdexcept>
+#include <string.h>
+
+using Json = SimpleJson::JsonObject;
+
+// accessor的componentType
+static const uint64_t GLTF_UNSIGNED_BYTE = 5121, GLTF_UNSIGNED_SHORT = 5123, GLTF_UNSIGNED_INT = 5125,
+                      GLTF_FLOAT = 5126;
+
+std::string read_whole_file(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        exit(-1);
+    }
+    std::string chunk;
+    char buffer[1 << 16];
+    for (size_t read; (read = fread(buffer, 1, sizeof(buffer), file)) > 0;)
+        chunk.append(buffer, read);
+    fclose(file);
+    return chunk;
+}
+
+// 引用其他对象的下标，不是小于size的非负整数时输出错误并退出
+static size_t checked_index(double index, size_t size, const char *what, const std::string &path) {
+    if (!(index >= 0 && index < (double)size && index == floor(index))) {
+        std::cerr << "Invalid " << what << " index " << index << " in " << path << std::endl;
+        exit(-1);
+    }
+    return (size_t)index;
+}
+
+// json[array][index]，检查下标的范围
+static const Json &element(const Json &json, const char *array, double index, const std::string &path) {
+    size_t i = checked_index(index, json.has(array) ? json[array].get_list().size() : 0, array, path);
+    return json[array][i];
+}
+
+// 长度至少为n的数字数组，如节点的matrix、rotation
+static const std::vector<Json> &numbers(const Json &object, const char *key, size_t n, const std::string &path) {
+    const std::vector<Json> &list = object[key].get_list();
+    if (list.size() < n) {
+        std::cerr << "Expected " << n << " numbers in " << key << " in " << path << std::endl;
+        exit(-1);
+    }
+    return list;
+}
+
+// accessor在缓冲中的数据：第i个元素从data + i * stride开始，可能没有对齐
+struct AccessorView {
+    const char *data = nullptr;
+    size_t stride = 0, element_size = 0;
+    uint32_t count = 0;
+    uint64_t component_type = 0;
+};
+
+static AccessorView get_accessor(const Json &json, const std::vector<std::string> &buffers, const Json &index,
+                                 const std::string &path) {
+    const Json &accessor = element(json, "accessors", index.get_number(), path);
+    if (!accessor.has("bufferView")) {
+        std::cerr << "Unsupported sparse or empty accessor " << index.get_number() << " in " << path << std::endl;
+        exit(-1);
+    }
+    const Json &view = element(json, "bufferViews", accessor["bufferView"].get_number(), path);
+    const std::string &buffer = buffers[checked_index(view["buffer"].get_number(), buffers.size(), "buffer", path)];
+
+    AccessorView result;
+    result.component_type = accessor["componentType"].get_uint();
+    const std::string &type = accessor["type"].get_string();
+    size_t components = type == "SCALAR" ? 1 : type == "VEC2" ? 2 : type == "VEC3" ? 3 : type == "VEC4" ? 4 : 16;
+    size_t component_size = result.component_type == GLTF_UNSIGNED_BYTE    ? 1
+                            : result.component_type == GLTF_UNSIGNED_SHORT ? 2
+                                                                            : 4;
+    result.element_size = components * component_size;
+    // 用double计算范围，文件中过大或为负的数不会在转换成整数时溢出
+    double count = accessor["count"].get_number();
+    double offset = (view.has("byteOffset") ? view["byteOffset"].get_number() : 0) +
+                    (accessor.has("byteOffset") ? accessor["byteOffset"].get_number() : 0);
+    double stride = view.has("byteStride") ? view["byteStride"].get_number() : (double)result.element_size;
+    double end = count > 0 ? offset + (count - 1) * stride + (double)result.element_size : offset;
+    if (!(count >= 0 && count <= UINT32_MAX && offset >= 0 && stride >= 0 && end <= (double)buffer.size())) {
+        std::cerr << "Accessor " << index.get_number() << " is out of its buffer in " << path << std::endl;
+        exit(-1);
+    }
+    result.count = (uint32_t)count;
+    result.stride = (size_t)stride;
+    result.data = buffer.data() + (size_t)offset;
+    return result;
+}
+
+static vec3 read_vec3(const AccessorView &accessor, uint32_t i) {
+    float f[3];
+    memcpy(f, accessor.data + i * accessor.stride, sizeof(f));
+    return vec3(f[0], f[1], f[2]);
+}
+
+static vec2 read_vec2(const AccessorView &accessor, uint32_t i) {
+    float f[2];
+    memcpy(f, accessor.data + i * accessor.stride, sizeof(f));
+    return vec2(f[0], f[1]);
+}
+
+static uint32_t read_index(const AccessorView &accessor, uint32_t i) {
+    const char *p = accessor.data + i * accessor.stride;
+    if (accessor.component_type == GLTF_UNSIGNED_BYTE)
+        return *(const uint8_t *)p;
+    if (accessor.component_type == GLTF_UNSIGNED_SHORT) {
+        uint16_t index;
+        memcpy(&index, p, sizeof(index));
+        return index;
+    }
+    uint32_t index;
+    memcpy(&index, p, sizeof(index));
+    return index;
+}
+
+// 顶点属性必须是float，每个元素至少有components个分量，至少有vertex_count个元素
+static void check_attribute(const AccessorView &accessor, size_t components, uint32_t vertex_count, const char *name,
+                            const std::string &path) {
+    if (accessor.component_type != GLTF_FLOAT) {
+        std::cerr << "Unsupported " << name << " component type " << accessor.component_type << " in " << path
+                  << std::endl;
+        exit(-1);
+    }
+    if (accessor.element_size < components * sizeof(float)) {
+        std::cerr << name << " needs " << components << " components in " << path << std::endl;
+        exit(-1);
+    }
+    if (accessor.count < vertex_count) {
+        std::cerr << name << " has fewer elements than POSITION in " << path << std::endl;
+        exit(-1);
+    }
+}
+
+// 网格的一个图元：三角形直接在mesh.triangles中构造，顶点法线和uv追加到mesh的顶点属性数组中
+static void load_primitive(const Json &json, const std::vector<std::string> &buffers, const Json &primitive,
+                           uint32_t material, const std::string &path, Mesh &mesh, bool &has_normals, bool &has_uvs) {
+    const Json &attributes = primitive["attributes"];
+    AccessorView position = get_accessor(json, buffers, attributes["POSITION"], path), normal, uv;
+    check_attribute(position, 3, position.count, "POSITION", path);
+    bool with_normals = attributes.has("NORMAL"), with_uvs = attributes.has("TEXCOORD_0");
+    if (with_normals) {
+        normal = get_accessor(json, buffers, attributes["NORMAL"], path);
+        check_attribute(normal, 3, position.count, "NORMAL", path);
+    }
+    if (with_uvs) {
+        uv = get_accessor(json, buffers, attributes["TEXCOORD_0"], path);
+        check_attribute(uv, 2, position.count, "TEXCOORD_0", path);
+    }
+    has_normals |= with_normals;
+    has_uvs |= with_uvs;
+
+    // 网格中各图元的顶点属性连续存放，没有的属性补0，最后整个网格都没有时再去掉
+    uint32_t base = (uint32_t)mesh.normals.size();
+    mesh.normals.reserve(base + position.count);
+    mesh.uvs.reserve(base + position.count);
+    for (uint32_t i = 0; i < position.count; i++) {
+        mesh.normals.push_back(with_normals ? read_vec3(normal, i) : vec3(0, 0, 0));
+        mesh.uvs.push_back(with_uvs ? read_vec2(uv, i) : vec2(0, 0));
+    }
+
+    bool indexed = primitive.has("indices");
+    AccessorView indices;
+    if (indexed)
+        indices = get_accessor(json, buffers, primitive["indices"], path);
+    uint32_t index_count = indexed ? indices.count : position.count;
+    mesh.triangles.reserve(mesh.triangles.size() + index_count / 3);
+    mesh.vertex_indices.reserve(mesh.vertex_indices.size() + index_count / 3 * 3);
+    for (uint32_t k = 0; k + 2 < index_count; k += 3) {
+        uint32_t v[3];
+        for (int j = 0; j < 3; j++) {
+            v[j] = indexed ? read_index(indices, k + j) : k + j;
+            if (v[j] >= position.count) {
+                std::cerr << "Vertex index " << v[j] << " out of range in " << path << std::endl;
+                exit(-1);
+            }
+        }
+        vec3 a = read_vec3(position, v[0]), b = read_vec3(position, v[1]), c = read_vec3(position, v[2]);
+        // 面积为0的三角形（如球面两极处）不会被光线击中，不放进网格
+        float area = 0.5f * length(cross(b - a, c - a));
+        if (!(area > 0))
+            continue;
+        // glTF的正面是逆时针顺序，与Triange的法线方向一致
+        Triange &triangle = mesh.triangles.emplace_back(a, b, c, material);
+        for (int j = 0; j < 3; j++)
+            mesh.vertex_indices.push_back(base + v[j]);
+        if (with_uvs) {
+            // 按真实的uv面积修正mip层级
+            vec2 e1 = mesh.uvs[base + v[1]] - mesh.uvs[base + v[0]], e2 = mesh.uvs[base + v[2]] - mesh.uvs[base + v[0]];
+            float uv_area = 0.5f * fabsf(e1.x * e2.y - e1.y * e2.x);
+            if (uv_area > 0)
+                triangle.uv_lod = 0.5f * log2f(uv_area / area);
+        }
+    }
+}
+
+// 节点的局部变换，按行向量约定：先缩放，再旋转，最后平移
+static mat4 node_transform(const Json &node, const std::string &path) {
+    if (node.has("matrix")) {
+        // glTF按列存放列向量约定的矩阵，依次读出正好是行向量约定的矩阵按行存放
+        const std::vector<Json> &m = numbers(node, "matrix", 16, path);
+        float f[16];
+        for (int i = 0; i < 16; i++)
+            f[i] = (float)m[i].get_number();
+        return mat4(f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9], f[10], f[11], f[12], f[13], f[14],
+                    f[15]);
+    }
+    vec3 scale(1, 1, 1), translation(0, 0, 0);
+    if (node.has("scale")) {
+        const std::vector<Json> &s = numbers(node, "scale", 3, path);
+        scale = vec3((float)s[0].get_number(), (float)s[1].get_number(), (float)s[2].get_number());
+    }
+    if (node.has("translation")) {
+        const std::vector<Json> &t = numbers(node, "translation", 3, path);
+        translation = vec3((float)t[0].get_number(), (float)t[1].get_number(), (float)t[2].get_number());
+    }
+    mat4 transform = ScaleMatrix(scale);
+    if (node.has("rotation")) {
+        // 单位四元数(x, y, z, w)即绕(x, y, z)旋转2 * atan2(|(x, y, z)|, w)
+        const std::vector<Json> &q = numbers(node, "rotation", 4, path);
+        vec3 axis((float)q[0].get_number(), (float)q[1].get_number(), (float)q[2].get_number());
+        float sin_half = length(axis);
+        if (sin_half > 0)
+            transform = transform * RotationMatrix(2 * atan2f(sin_half, (float)q[3].get_number()), axis);
+    }
+    return transform * TranslateMatrix(translation);
+}
+
+// 节点树中的节点最多出现一次（glTF的要求），visited用于发现环
+static void add_node(const Json &json, const Json &index, const mat4 &parent, const std::string &path,
+                     std::vector<bool> &visited, GltfScene &result) {
+    const Json &node = element(json, "nodes", index.get_number(), path);
+    size_t i = (size_t)index.get_number();
+    if (visited[i]) {
+        std::cerr << "Node " << i << " appears more than once in the node tree of " << path << std::endl;
+        exit(-1);
+    }
+    visited[i] = true;
+    mat4 transform = node_transform(node, path) * parent;
+    if (node.has("mesh"))
+        result.instances.emplace_back(
+            (uint32_t)checked_index(node["mesh"].get_number(), result.meshes.size(), "mesh", path), transform);
+    if (node.has("children"))
+        for (const Json &child : node["children"].get_list())
+            add_node(json, child, transform, path, visited, result);
+}
+
+// 路径中的目录部分，包含最后的'/'
+static std::string directory_of(const std::string &path) {
+    std::string root = path;
+    for (; !(root.empty() || root.back() == '/' || root.back() == '\\'); root.pop_back())
+        ;
+    return root;
+}
+
+static GltfScene parse_gltf(const std::string &path, uint32_t material) {
+    std::string root = directory_of(path);
+    Json json = SimpleJson::parse_file(path);
+
+    // .bin整个读入内存，顶点数据由accessor直接从中读取
+    std::vector<std::string> buffers;
+    if (json.has("buffers")) {
+        for (const Json &buffer : json["buffers"].get_list()) {
+            if (!buffer.has("uri") || buffer["uri"].get_string().compare(0, 5, "data:") == 0) {
+                std::cerr << "Only external .bin buffers are supported: " << path << std::endl;
+                exit(-1);
+            }
+            std::string bin_path = root + buffer["uri"].get_string();
+            buffers.push_back(read_whole_file(bin_path));
+            if (buffers.back().size() < buffer["byteLength"].get_uint()) {
+                std::cerr << "Buffer is shorter than its byteLength: " << bin_path << std::endl;
+                exit(-1);
+            }
+        }
+    }
+
+    GltfScene result;
+    if (json.has("meshes")) {
+        for (const Json &mesh_desc : json["meshes"].get_list()) {
+            Mesh &mesh = result.meshes.emplace_back();
+            bool has_normals = false, has_uvs = false;
+            for (const Json &primitive : mesh_desc["primitives"].get_list()) {
+                // 只支持三角形列表（mode 4，默认值）
+                if (primitive.has("mode") && primitive["mode"].get_uint() != 4) {
+                    std::cerr << "Skipping non-triangle primitive in " << path << std::endl;
+                    continue;
+                }
+                load_primitive(json, buffers, primitive, material, path, mesh, has_normals, has_uvs);
+            }
+            if (!has_normals)
+                mesh.normals.clear();
+            if (!has_uvs)
+                mesh.uvs.clear();
+            if (!has_normals && !has_uvs)
+                mesh.vertex_indices.clear();
+            mesh.triangles.shrink_to_fit();
+            mesh.normals.shrink_to_fit();
+            mesh.uvs.shrink_to_fit();
+            mesh.vertex_indices.shrink_to_fit();
+            result.triangle_count += mesh.triangles.size();
+        }
+    }
+
+    // 默认场景中的节点树；没有场景时每个网格放一次，不做变换
+    mat4 identity = ScaleMatrix(vec3(1, 1, 1));
+    if (json.has("scenes") && json.has("nodes")) {
+        const Json &scene = element(json, "scenes", json.has("scene") ? json["scene"].get_number() : 0, path);
+        std::vector<bool> visited(json["nodes"].get_list().size());
+        if (scene.has("nodes"))
+            for (const Json &node : scene["nodes"].get_list())
+                add_node(json, node, identity, path, visited, result);
+    } else {
+        for (uint32_t i = 0; i < result.meshes.size(); i++)
+            result.instances.emplace_back(i, identity);
+    }
+    return result;
+}
+
+// 缺少必需的键（JsonObject::operator[]抛出std::out_of_range）或值的类型不对（std::bad_variant_access）
+static void malformed(const std::string &path, const std::exception &error) {
+    std::cerr << "Malformed glTF file " << path << ": " << error.what() << std::endl;
+    exit(-1);
+}
+
+GltfScene load_gltf(const std::string &path, uint32_t material) {
+    try {
+        return parse_gltf(path, material);
+    } catch (const std::exception &error) {
+        malformed(path, error);
+    }
+    return GltfScene();
+}
+
+std::vector<std::string> gltf_files(const std::string &path) {
+    std::vector<std::string> files = {path};
+    try {
+        Json json = SimpleJson::parse_file(path);
+        if (json.has("buffers"))
+            for (const Json &buffer : json["buffers"].get_list())
+                if (buffer.has("uri"))
+                    files.push_back(directory_of(path) + buffer["uri"].get_string());
+    } catch (const std::exception &error) {
+        malformed(path, error);
+    }
+    return files;
+}
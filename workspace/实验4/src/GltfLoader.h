@@ -0,0 +1,22 @@
+#pragma once
+
+#include "PrimitiveStore.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+//---------------------------
+// 从glTF文件读入的网格和场景节点
+struct GltfScene {
+    vector<Mesh> meshes;                         // glTF中的每个网格，各图元（primitive）合并为一个Mesh，未建BVH
+    vector<std::pair<uint32_t, mat4>> instances; // 场景中引用网格的节点：网格在meshes中的下标和节点的世界变换
+    size_t triangle_count = 0;
+};
+
+// 读取.gltf和它引用的.bin缓冲。位置、法线和uv通过accessor直接从缓冲读到网格的三角形和顶点属性数组中，
+// 所有三角形使用同一个材质material。只支持float类型的顶点属性和三角形列表。文件有错（缺少必需的键、
+// 下标越界、节点树中有环等）时输出错误并退出
+GltfScene load_gltf(const std::string &path, uint32_t material);
+// glTF文件本身和它引用的.bin缓冲的路径，用于判断缓存是否过期
+std::vector<std::string> gltf_files(const std::string &path);
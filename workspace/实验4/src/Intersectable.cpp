@@ -1,72 +1,119 @@
 #include "Intersectable.h"
 
-Hit Sphere::intersect(const Ray &ray) {
-    Hit hit;
+float Sphere::distance(const Ray &ray) const {
     vec3 dist = ray.start - center;  // 距离
     float a = dot(ray.dir, ray.dir); // dot表示点乘，这里是联立光线与球面方程
     float b = dot(dist, ray.dir) * 2.0f;
     float c = dot(dist, dist) - radius * radius;
     float discr = b * b - 4.0f * a * c; // b^2-4ac
     if (discr < 0)                      // 无交点
-        return hit;
+        return -1;
     float sqrt_discr = sqrtf(discr);
     float s1 = (-b + sqrt_discr) / 2.0f / a; // 求得两个交点，s1 >= s2
     float s2 = (-b - sqrt_discr) / 2.0f / a;
     if (s1 <= 0)
-        return hit;
-    hit.s = (s2 > 0) ? s2 : s1; // 取近的那个交点
+        return -1;
+    return (s2 > 0) ? s2 : s1; // 取近的那个交点
+}
+void Sphere::finalize_hit(const Ray &ray, Hit &hit) const {
     hit.position = ray.start + ray.dir * hit.s;
     hit.normal = (hit.position - center) / radius;
     hit.uv = vec2(0, 0); // 不考虑球面uv
-    hit.material = &material;
-    return hit;
+    hit.material = material;
+}
+void Sphere::intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const {
+    // 与标量版本的运算顺序相同，保证得到的距离完全一致
+    vec3p dist = packet.start - vec3p(center);
+    vfloat a = dot(packet.dir, packet.dir);
+    vfloat b = dot(dist, packet.dir) * vfloat(2.0f);
+    vfloat c = dot(dist, dist) - vfloat(radius * radius);
+    vfloat discr = b * b - vfloat(4.0f) * a * c;
+    vfloat sqrt_discr = vsqrt(discr);
+    vfloat s1 = (-b + sqrt_discr) / vfloat(2.0f) / a;
+    vfloat s2 = (-b - sqrt_discr) / vfloat(2.0f) / a;
+    vfloat s = select(s2 > vfloat(0.0f), s2, s1);
+    hit.update((discr >= vfloat(0.0f)) & (s1 > vfloat(0.0f)), s, id);
+}
+bool Sphere::occludes(const Ray &ray, float t_max) const {
+    vec3 dist = ray.start - center;
+    float a = dot(ray.dir, ray.dir);
+    float b = dot(dist, ray.dir) * 2.0f;
+    float c = dot(dist, dist) - radius * radius;
+    float discr = b * b - 4.0f * a * c;
+    if (discr < 0)
+        return false;
+    float sqrt_discr = sqrtf(discr);
+    float s1 = (-b + sqrt_discr) / 2.0f / a;
+    float s2 = (-b - sqrt_discr) / 2.0f / a;
+    float s = (s2 > 0) ? s2 : s1;
+    return s1 > 0 && s < t_max;
 }
-Hit Plane::intersect(const Ray &ray) {
-    Hit hit;
+
+AABB Sphere::get_bounds() const {
+    AABB box;
+    box.expand(center - vec3(radius, radius, radius));
+    box.expand(center + vec3(radius, radius, radius));
+    return box;
+}
+
+float Plane::distance(const Ray &ray) const {
     // 射线方向与法向量点乘，为0表示平行
     float nD = dot(ray.dir, normal);
     if (nD == 0)
-        return hit;
+        return -1;
 
-    // 无效交点
+    // 交点在背后时无效
     float s1 = (dot(normal, p0) - dot(normal, ray.start)) / nD;
-    if (s1 < 0)
-        return hit;
-
-    // 交点
-    hit.s = s1;
+    return s1 < 0 ? -1 : s1;
+}
+void Plane::finalize_hit(const Ray &ray, Hit &hit) const {
     hit.position = ray.start + ray.dir * hit.s;
     hit.normal = normal;
     hit.uv = vec2(0, 0); // 不用
-    hit.material = &material;
-
-    return hit;
+    hit.material = material;
 }
-Hit Triange::intersect(const Ray &ray) {
-    Hit hit;
-    // 射线方向与法向量相同，不可见
+void Plane::intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const {
+    vfloat nD = dot(packet.dir, vec3p(normal));
+    vfloat s1 = (vfloat(dot(normal, p0)) - dot(packet.start, vec3p(normal))) / nD;
+    hit.update((nD != vfloat(0.0f)) & (s1 >= vfloat(0.0f)), s1, id);
+}
+bool Plane::occludes(const Ray &ray, float t_max) const {
     float nD = dot(ray.dir, normal);
-    if (nD >= 0){
-        return hit;
-    }
-
-    float distance = dot(v1 - ray.start, normal) / nD;
-    if (distance < 0) {
-        return hit; // 在背后
-    }
-
-    vec3 point = ray.start + ray.dir * distance;
-    vec2 uv = solve_uv_guass(v1, v2, v3, point);
-    if (uv[0] < 0.0 || uv[1] < 0.0 || uv[0] + uv[1] > 1.0) {
-        return hit; // 交点在三角形外
-    }
+    if (nD == 0)
+        return false;
+    float s1 = (dot(normal, p0) - dot(normal, ray.start)) / nD;
+    return s1 > 0 && s1 < t_max;
+}
 
-    // 交点
-    hit.s = distance;
-    hit.position = point;
+float Triange::distance(const Ray &ray) const { return triangle_distance(ray, v1, v3, normal, u_axis, v_axis); }
+void Triange::finalize_hit(const Ray &ray, Hit &hit) const {
+    // 与distance中的运算相同，uv与求交时判断的一致
+    triangle_hit_point(ray, v3, u_axis, v_axis, hit);
     hit.normal = normal;
-    hit.uv = uv;
-    hit.material = &material;
+    hit.material = material;
+    hit.uv_lod = uv_lod;
+}
+
+void Triange::intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const {
+    vfloat nD = dot(packet.dir, vec3p(normal));
+    vfloat distance = dot(vec3p(v1) - packet.start, vec3p(normal)) / nD;
+    vec3p p = packet.start + packet.dir * distance - vec3p(v3);
+    vfloat u = dot(p, vec3p(u_axis)), v = dot(p, vec3p(v_axis));
+    vfloat zero(0.0f);
+    hit.update((nD < zero) & (distance >= zero) & (u >= zero) & (v >= zero) & (u + v <= vfloat(1.0f)), distance, id);
+}
+bool Triange::occludes(const Ray &ray, float t_max) const {
+    float nD = dot(ray.dir, normal);
+    float distance = dot(v1 - ray.start, normal) / nD;
+    vec3 p = ray.start + ray.dir * distance - v3;
+    float u = dot(p, u_axis), v = dot(p, v_axis);
+    return (nD < 0) & (distance > 0) & (distance < t_max) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f);
+}
 
-    return hit;
+AABB Triange::get_bounds() const {
+    AABB box;
+    box.expand(v1);
+    box.expand(v2);
+    box.expand(v3);
+    return box;
 }
@@ -2,12 +2,17 @@
 
 #include "glmath.h"
 #include "Material.h"
+#include "Packet.h"
+#include <algorithm>
+#include <float.h>
+#include <vector>
 
 //---------------------------
 // 射线（从屏幕上某点出发追踪的射线），光线
 struct Ray		
 {
 	vec3 start, dir;				// 起点，方向
+	Ray() {}
 	Ray(vec3 _start, vec3 _dir) {
 		start = _start;
 
@@ -17,65 +22,163 @@ struct Ray
 };
 
 //---------------------------
-// 光线和物体表面交点
+// 轴对齐包围盒
+struct AABB
+{
+    vec3 min, max;
+    AABB() : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+
+    void expand(const vec3 &p) {
+        min = vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+        max = vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+    }
+    void expand(const AABB &b) {
+        min = vec3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z));
+        max = vec3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z));
+    }
+    vec3 center() const { return (min + max) * 0.5f; }
+    // 表面积，用于SAH估价
+    float surface_area() const {
+        if (min.x > max.x) return 0.0f;
+        vec3 d = max - min;
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+    // slab法求交，返回光线进入包围盒的距离，不相交返回false
+    bool intersect(const vec3 &start, const vec3 &inv_dir, float t_max, float &t_near) const {
+        float tx1 = (min.x - start.x) * inv_dir.x, tx2 = (max.x - start.x) * inv_dir.x;
+        float ty1 = (min.y - start.y) * inv_dir.y, ty2 = (max.y - start.y) * inv_dir.y;
+        float tz1 = (min.z - start.z) * inv_dir.z, tz2 = (max.z - start.z) * inv_dir.z;
+        // 用std::min/max而不是fminf/fmaxf，后者要处理NaN，编译器不会展开成单条指令
+        float t0 = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+        float t1 = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+        t_near = t0;
+        return t1 >= t0 && t1 >= 0 && t0 <= t_max;
+    }
+    // 光线包版本，返回每条光线是否相交的掩码
+    vfloat intersect(const RayPacket &packet, vfloat t_max, vfloat &t_near) const {
+        vfloat tx1 = (vfloat(min.x) - packet.start.x) * packet.inv_dir.x;
+        vfloat tx2 = (vfloat(max.x) - packet.start.x) * packet.inv_dir.x;
+        vfloat ty1 = (vfloat(min.y) - packet.start.y) * packet.inv_dir.y;
+        vfloat ty2 = (vfloat(max.y) - packet.start.y) * packet.inv_dir.y;
+        vfloat tz1 = (vfloat(min.z) - packet.start.z) * packet.inv_dir.z;
+        vfloat tz2 = (vfloat(max.z) - packet.start.z) * packet.inv_dir.z;
+        vfloat t0 = vmax(vmax(vmin(tx1, tx2), vmin(ty1, ty2)), vmin(tz1, tz2));
+        vfloat t1 = vmin(vmin(vmax(tx1, tx2), vmax(ty1, ty2)), vmax(tz1, tz2));
+        t_near = t0;
+        return (t1 >= t0) & (t1 >= vfloat(0.0f)) & (t0 <= t_max);
+    }
+};
+
+// 方向的倒数，分量为0时取一个极小值，避免slab测试中出现0*inf
+inline vec3 safe_inverse(const vec3 &d) {
+    auto inv = [](float x) { return 1.0f / (fabsf(x) > 1e-20f ? x : copysignf(1e-20f, x)); };
+    return vec3(inv(d.x), inv(d.y), inv(d.z));
+}
+
+//---------------------------
+// 光线和物体表面交点。遍历时只比较各图元的距离，找到最近的图元后才由它的finalize_hit构造一次
 struct Hit		
 {
 	float s;					// 距离，直线方程P=P0+su。当t大于0时表示相交，默认取-1表示无交点
     vec2 uv;
 	vec3 position, normal;		// 交点坐标，法线
-	Material* material;			// 交点处表面的材质
-	Hit() { s = -1; }
+	uint32_t material;			// 交点处表面的材质在场景材质表中的下标
+	float uv_lod;				// 0.5*log2(uv面积/表面积)，用于由光线的footprint求纹理的mip层级
+	Hit() { s = -1; uv_lod = 0; }
 };
 //---------------------------
-// 为物品类定义一个基类，表示可求交
-class Intersectable			
-{
-public:
-    Intersectable(Material _material): material(_material) {}
-	// 虚函数，需要根据不同物品表面类型实现求交
-	virtual Hit intersect(const Ray& ray) = 0;		
-    virtual ~Intersectable(){}
-
-protected:
-	Material material;
-};
+// 图元按类型分别存放在连续的数组里，不再是各自分配的虚函数对象；
+// 材质存放在场景的材质表中，图元只保存材质下标
 
 //---------------------------
 // 定义球体
-class Sphere : public Intersectable		
+struct Sphere
 {
 	vec3 center;
 	float radius;
-public:
-	Sphere(const vec3& _center, float _radius, Material _material): Intersectable(_material), center(_center), radius(_radius) {}
-	~Sphere() {}
+	uint32_t material;
+
+	Sphere(const vec3& _center, float _radius, uint32_t _material): center(_center), radius(_radius), material(_material) {}
 
-	// 光线与球体求交点
-    Hit intersect(const Ray &ray);
+	// 光线与球体求交，只求距离，无交点返回负数
+    float distance(const Ray &ray) const;
+	// 补全交点的位置、法线、uv和材质，hit.s为distance求得的距离
+    void finalize_hit(const Ray &ray, Hit &hit) const;
+	// 光线包求交，只更新每条光线的最近距离和图元引用，id为该图元的引用
+    void intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const;
+	// 遮挡测试：光线在(0, t_max)内是否与图元相交，只求距离，不计算交点的其他信息
+    bool occludes(const Ray &ray, float t_max) const;
+    AABB get_bounds() const;
 };
 
 //---------------------------
-// 平面
-class Plane :public Intersectable
+// 平面，无限大，没有包围盒
+struct Plane
 {	// 点法式方程表示平面
 	vec3 normal;		// 法线
 	vec3 p0;			// 线上一点坐标，N(p-p0)=0
+	uint32_t material;
 
-public:
-	Plane(vec3 _p0, vec3 _normal, Material _material): Intersectable(_material), normal(_normal), p0(_p0) {}
+	Plane(vec3 _p0, vec3 _normal, uint32_t _material): normal(_normal), p0(_p0), material(_material) {}
 
-	// 光线与平面求交点
-    Hit intersect(const Ray &ray);
+	// 光线与平面求交，只求距离
+    float distance(const Ray &ray) const;
+    void finalize_hit(const Ray &ray, Hit &hit) const;
+    void intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const;
+    bool occludes(const Ray &ray, float t_max) const;
 };
 
-class Triange :public Intersectable
+// 三角形的求交运算：v1为平面上一点，交点p的重心坐标为u = dot(p - v3, u_axis)，v = dot(p - v3, v_axis)。
+// Triange和压缩BVH中的CompactTriangle共用这两个函数，边上的光线在两种布局中结果完全相同。
+// 射线方向与法向量相同时不可见；交点在背后或在三角形外时返回-1。所有条件合并成一个掩码，中间没有分支
+inline float triangle_distance(const Ray &ray, const vec3 &v1, const vec3 &v3, const vec3 &normal, const vec3 &u_axis,
+                               const vec3 &v_axis) {
+    float nD = dot(ray.dir, normal);
+    float distance = dot(v1 - ray.start, normal) / nD;
+    vec3 p = ray.start + ray.dir * distance - v3;
+    float u = dot(p, u_axis), v = dot(p, v_axis);
+    bool inside = (nD < 0) & (distance >= 0) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f);
+    return inside ? distance : -1;
+}
+// 距离为hit.s的交点的位置和重心坐标，与triangle_distance中的运算相同
+inline void triangle_hit_point(const Ray &ray, const vec3 &v3, const vec3 &u_axis, const vec3 &v_axis, Hit &hit) {
+    hit.position = ray.start + ray.dir * hit.s;
+    vec3 p = hit.position - v3;
+    hit.uv = vec2(dot(p, u_axis), dot(p, v_axis));
+}
+
+struct Triange
 {	// 点法式方程表示平面
     vec3 v1, v2, v3; //三个顶点
 	vec3 normal;// 法线
+	// 构建时预计算的重心坐标基：交点p满足 p - v3 = u(v1 - v3) + v(v2 - v3)，
+	// 则 u = dot(p - v3, u_axis)，v = dot(p - v3, v_axis)，不需要每次解方程组
+	vec3 u_axis, v_axis;
+	uint32_t material;
+	// uv是重心坐标，uv空间中三角形面积为0.5
+	float uv_lod;
 
-public:
-	Triange(vec3 v1, vec3 v2, vec3 v3, Material _material): Intersectable(_material), v1(v1), v2(v2), v3(v3), normal(normalize(cross(v3 - v2, v1 - v2))) {}
+	Triange(vec3 v1, vec3 v2, vec3 v3, uint32_t _material): v1(v1), v2(v2), v3(v3), normal(normalize(cross(v3 - v2, v1 - v2))), material(_material) {
+		vec3 e1 = v1 - v3, e2 = v2 - v3;
+		vec3 a = cross(e2, normal), b = cross(normal, e1);
+		u_axis = a / dot(e1, a);
+		v_axis = b / dot(e2, b);
+		float area = 0.5f * length(cross(e1, e2));
+		uv_lod = area > 0 ? 0.5f * log2f(0.5f / area) : 0;
+	}
 
-	// 光线与三角形求交点
-    Hit intersect(const Ray &ray);
+	// 光线与三角形求交，只求距离
+    float distance(const Ray &ray) const;
+    void finalize_hit(const Ray &ray, Hit &hit) const;
+    void intersect_packet(const RayPacket &packet, PacketHit &hit, uint32_t id) const;
+    bool occludes(const Ray &ray, float t_max) const;
+    AABB get_bounds() const;
 };
+
+//---------------------------
+// 图元类型，图元引用的高2位保存类型，低30位保存在该类型数组中的下标
+enum PrimitiveType { PRIM_SPHERE, PRIM_TRIANGLE, PRIM_PLANE, PRIM_INSTANCE };
+
+inline uint32_t make_primitive_ref(PrimitiveType type, uint32_t index) { return ((uint32_t)type << 30) | index; }
+inline PrimitiveType primitive_type(uint32_t ref) { return (PrimitiveType)(ref >> 30); }
+inline uint32_t primitive_index(uint32_t ref) { return ref & 0x3fffffff; }
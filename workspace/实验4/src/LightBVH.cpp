@@ -0,0 +1,84 @@
+#include "LightBVH.h"
+
+#include <algorithm>
+#include <math.h>
+
+void LightBVH::build(const std::vector<vec3> &positions, const std::vector<float> &powers) {
+    nodes.clear();
+    if (positions.empty())
+        return;
+    std::vector<uint32_t> lights(positions.size());
+    for (uint32_t i = 0; i < lights.size(); i++)
+        lights[i] = i;
+    nodes.reserve(2 * lights.size() - 1);
+    nodes.emplace_back();
+    build_node(0, lights.data(), (uint32_t)lights.size(), positions, powers);
+}
+
+void LightBVH::build_node(uint32_t node, uint32_t *lights, uint32_t count, const std::vector<vec3> &positions,
+                          const std::vector<float> &powers) {
+    AABB box;
+    float power = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        box.expand(positions[lights[i]]);
+        power += powers[lights[i]];
+    }
+    nodes[node].box = box;
+    nodes[node].power = power;
+    if (count == 1) {
+        nodes[node].first = lights[0];
+        nodes[node].count = 1;
+        return;
+    }
+    // 沿包围盒最长的轴按位置的中位数分成两半
+    vec3 extent = box.max - box.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    uint32_t half = count / 2;
+    std::nth_element(lights, lights + half, lights + count,
+                     [&](uint32_t a, uint32_t b) { return positions[a][axis] < positions[b][axis]; });
+
+    uint32_t children = (uint32_t)nodes.size();
+    nodes[node].first = children;
+    nodes[node].count = 0;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    build_node(children, lights, half, positions, powers);
+    build_node(children + 1, lights + half, count - half, positions, powers);
+}
+
+float LightBVH::importance(const LightBVHNode &node, vec3 P, vec3 N) const {
+    // 包围盒上dot(N, X - P)的最大值在某个顶点上取到，不大于0时子树中的光源都在表面背后，照不到着色点
+    vec3 d = node.box.center() - P;
+    vec3 half_extent = (node.box.max - node.box.min) * 0.5f;
+    if (dot(N, d) + fabsf(N.x) * half_extent.x + fabsf(N.y) * half_extent.y + fabsf(N.z) * half_extent.z <= 0)
+        return 0;
+    // 距离取到包围盒中心的距离，但不小于包围盒的半径，避免着色点靠近或在包围盒内时权重过大
+    float squared_distance = std::max(dot(d, d), dot(half_extent, half_extent));
+    return node.power / std::max(squared_distance, 1e-6f);
+}
+
+bool LightBVH::sample(vec3 P, vec3 N, float u, uint32_t &light, float &pmf) const {
+    if (nodes.empty())
+        return false;
+    pmf = 1;
+    const LightBVHNode *node = &nodes[0];
+    while (node->count == 0) {
+        const LightBVHNode &left = nodes[node->first], &right = nodes[node->first + 1];
+        float w_left = importance(left, P, N), w_right = importance(right, P, N);
+        if (w_left + w_right <= 0)
+            return false;
+        // 选中一支后把u重新缩放到[0, 1)，继续用于下一层
+        float p_left = w_left / (w_left + w_right);
+        if (u < p_left) {
+            u = std::min(u / p_left, 0.99999994f);
+            pmf *= p_left;
+            node = &left;
+        } else {
+            u = std::min((u - p_left) / (1 - p_left), 0.99999994f);
+            pmf *= 1 - p_left;
+            node = &right;
+        }
+    }
+    light = node->first;
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Intersectable.h"
+
+#include <stdint.h>
+#include <vector>
+
+//---------------------------
+// 光源BVH节点，count为0时是内部节点，两个子节点为nodes[first]和nodes[first + 1]；
+// 否则是只包含一个光源的叶子节点，first为光源下标
+struct LightBVHNode {
+    AABB box;    // 子树中光源位置的包围盒
+    float power; // 子树中光源的总功率
+    uint32_t first;
+    uint32_t count;
+};
+
+//---------------------------
+// 点光源的层次结构：从根节点向下，按两个子树对着色点的估计贡献（功率除以距离平方，
+// 完全在表面背后的子树为0）随机选择一支，直到叶子，得到一个光源和选中它的概率
+class LightBVH {
+public:
+    // positions和powers为每个光源的位置和功率
+    void build(const std::vector<vec3> &positions, const std::vector<float> &powers);
+
+    bool empty() const { return nodes.empty(); }
+    size_t node_count() const { return nodes.size(); }
+
+    // 为位置P、法线N的着色点按u（[0, 1)之间）选一个光源，pmf为选中的概率。
+    // 所有光源都在表面背后时返回false
+    bool sample(vec3 P, vec3 N, float u, uint32_t &light, float &pmf) const;
+
+private:
+    // 子树对着色点的估计贡献
+    float importance(const LightBVHNode &node, vec3 P, vec3 N) const;
+    void build_node(uint32_t node, uint32_t *lights, uint32_t count, const std::vector<vec3> &positions,
+                    const std::vector<float> &powers);
+
+    std::vector<LightBVHNode> nodes;
+};
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "glmath.h"
+#include "Texture.h"
 #include <FreeImage.h>
+#include <memory>
 #include <string>
 
 FIBITMAP *freeimage_load_and_convert_image(const std::string &image_path);
@@ -10,14 +12,6 @@ FIBITMAP *freeimage_load_and_convert_image(const std::string &image_path);
 // 粗糙(Rough)、反射型(Reflective)、折射型/透明物体(Refractive/Transparent)
 enum MaterialType { ROUGH, ROUGH_TEXTURE, REFLECTIVE, REFRACTIVE };
 
-inline vec3 sample_image(FIBITMAP* image, vec2 uv){
-    unsigned int w = FreeImage_GetWidth(image);
-    unsigned int h = FreeImage_GetHeight(image);
-    RGBQUAD rgb;
-    FreeImage_GetPixelColor(image, w * uv[0], h * uv[1], &rgb);
-
-    return vec3(rgb.rgbRed / 255.0f, rgb.rgbGreen / 255.0f, rgb.rgbBlue / 255.0f);
-}
 //---------------------------
 // 材质基类
 struct Material
@@ -30,7 +24,7 @@ struct Material
 	vec3 F0;
 	// 折射率索引（index of refraction）			
 	float ior;			
-    FIBITMAP* texture; // 贴图
+    std::shared_ptr<const Texture> texture; // 贴图，加载时已解码并生成mipmap
 	MaterialType type;
 	Material(MaterialType t) { type = t; }
 
@@ -44,10 +38,10 @@ struct Material
         return m;
     }
 
-    // 粗糙贴图材质
+    // 粗糙贴图材质，同一路径的贴图在TextureCache中共享
     static Material TextureMaterial(const std::string &image_path, vec3 _ks, float _shininess){
         Material m(ROUGH_TEXTURE);
-        m.texture = freeimage_load_and_convert_image(image_path);
+        m.texture = TextureCache::instance().get(image_path);
 		m.ks = _ks;
 		m.shininess = _shininess;
         return m;
@@ -0,0 +1,155 @@
+#pragma once
+
+#include "glmath.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+// 光线包：一次对相邻的多条主光线求交。
+// 编译时开启AVX(/arch:AVX或-mavx)则一个包是4x2共8条光线，否则使用SSE，一个包是2x2共4条光线
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PACKET_WIDTH 4
+#define PACKET_HEIGHT 2
+#else
+#include <emmintrin.h>
+#define PACKET_WIDTH 2
+#define PACKET_HEIGHT 2
+#endif
+#define PACKET_SIZE (PACKET_WIDTH * PACKET_HEIGHT)
+
+//---------------------------
+// PACKET_SIZE个float，比较运算的结果也用vfloat表示（每个分量全1或全0的掩码）
+struct vfloat {
+#if defined(__AVX__)
+    __m256 v;
+    vfloat() {}
+    vfloat(__m256 _v) : v(_v) {}
+    vfloat(float f) : v(_mm256_set1_ps(f)) {}
+    static vfloat load(const float *p) { return _mm256_loadu_ps(p); }
+    void store(float *p) const { _mm256_storeu_ps(p, v); }
+#else
+    __m128 v;
+    vfloat() {}
+    vfloat(__m128 _v) : v(_v) {}
+    vfloat(float f) : v(_mm_set1_ps(f)) {}
+    static vfloat load(const float *p) { return _mm_loadu_ps(p); }
+    void store(float *p) const { _mm_storeu_ps(p, v); }
+#endif
+};
+
+#if defined(__AVX__)
+inline vfloat operator+(vfloat a, vfloat b) { return _mm256_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm256_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm256_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm256_div_ps(a.v, b.v); }
+inline vfloat operator<(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+inline vfloat operator>(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+inline vfloat operator==(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+inline vfloat operator!=(vfloat a, vfloat b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_OQ); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm256_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm256_or_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm256_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm256_max_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm256_sqrt_ps(a.v); }
+// mask对应分量为真时取a，否则取b
+inline vfloat select(vfloat mask, vfloat a, vfloat b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+inline int movemask(vfloat mask) { return _mm256_movemask_ps(mask.v); }
+// 分量按位保存uint32_t时，按无符号整数比较a < b。AVX没有256位整数比较，拆成两半用SSE2
+inline vfloat less_uint(vfloat a, vfloat b) {
+    const __m128i sign = _mm_set1_epi32((int)0x80000000);
+    auto less = [&](__m128 x, __m128 y) {
+        return _mm_castsi128_ps(_mm_cmplt_epi32(_mm_xor_si128(_mm_castps_si128(x), sign),
+                                                _mm_xor_si128(_mm_castps_si128(y), sign)));
+    };
+    __m128 lo = less(_mm256_castps256_ps128(a.v), _mm256_castps256_ps128(b.v));
+    __m128 hi = less(_mm256_extractf128_ps(a.v, 1), _mm256_extractf128_ps(b.v, 1));
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+#else
+inline vfloat operator+(vfloat a, vfloat b) { return _mm_add_ps(a.v, b.v); }
+inline vfloat operator-(vfloat a, vfloat b) { return _mm_sub_ps(a.v, b.v); }
+inline vfloat operator*(vfloat a, vfloat b) { return _mm_mul_ps(a.v, b.v); }
+inline vfloat operator/(vfloat a, vfloat b) { return _mm_div_ps(a.v, b.v); }
+inline vfloat operator<(vfloat a, vfloat b) { return _mm_cmplt_ps(a.v, b.v); }
+inline vfloat operator<=(vfloat a, vfloat b) { return _mm_cmple_ps(a.v, b.v); }
+inline vfloat operator>(vfloat a, vfloat b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline vfloat operator>=(vfloat a, vfloat b) { return _mm_cmpge_ps(a.v, b.v); }
+inline vfloat operator==(vfloat a, vfloat b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline vfloat operator!=(vfloat a, vfloat b) { return _mm_cmpneq_ps(a.v, b.v); }
+inline vfloat operator&(vfloat a, vfloat b) { return _mm_and_ps(a.v, b.v); }
+inline vfloat operator|(vfloat a, vfloat b) { return _mm_or_ps(a.v, b.v); }
+inline vfloat vmin(vfloat a, vfloat b) { return _mm_min_ps(a.v, b.v); }
+inline vfloat vmax(vfloat a, vfloat b) { return _mm_max_ps(a.v, b.v); }
+inline vfloat vsqrt(vfloat a) { return _mm_sqrt_ps(a.v); }
+// mask对应分量为真时取a，否则取b
+inline vfloat select(vfloat mask, vfloat a, vfloat b) {
+    return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline int movemask(vfloat mask) { return _mm_movemask_ps(mask.v); }
+// 分量按位保存uint32_t时，按无符号整数比较a < b
+inline vfloat less_uint(vfloat a, vfloat b) {
+    const __m128i sign = _mm_set1_epi32((int)0x80000000);
+    return _mm_castsi128_ps(
+        _mm_cmplt_epi32(_mm_xor_si128(_mm_castps_si128(a.v), sign), _mm_xor_si128(_mm_castps_si128(b.v), sign)));
+}
+#endif
+
+// 把uint32_t按位放进vfloat的每个分量
+inline vfloat splat_uint(uint32_t value) {
+    float f;
+    memcpy(&f, &value, sizeof(f));
+    return vfloat(f);
+}
+
+inline vfloat operator-(vfloat a) { return vfloat(0.0f) - a; }
+
+//---------------------------
+// PACKET_SIZE个vec3，按分量分开存放
+struct vec3p {
+    vfloat x, y, z;
+    vec3p() {}
+    vec3p(vfloat _x, vfloat _y, vfloat _z) : x(_x), y(_y), z(_z) {}
+    vec3p(const vec3 &v) : x(v.x), y(v.y), z(v.z) {}
+
+    vec3p operator+(const vec3p &v) const { return vec3p(x + v.x, y + v.y, z + v.z); }
+    vec3p operator-(const vec3p &v) const { return vec3p(x - v.x, y - v.y, z - v.z); }
+    vec3p operator*(vfloat a) const { return vec3p(x * a, y * a, z * a); }
+};
+
+inline vfloat dot(const vec3p &v1, const vec3p &v2) { return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z; }
+
+//---------------------------
+// 光线包
+struct RayPacket {
+    vec3p start, dir;
+    vec3p inv_dir; // 方向的倒数，用于包围盒求交
+};
+
+//---------------------------
+// 光线包中每条光线的最近交点，只记录距离和图元引用，交点的其他信息由标量求交补全。
+// 图元引用按位保存在vfloat中
+struct PacketHit {
+    vfloat s;  // 没有交点时为FLT_MAX
+    vfloat id; // 图元引用，没有交点时为UINT32_MAX
+    PacketHit() : s(FLT_MAX), id(splat_uint(UINT32_MAX)) {}
+
+    // 用图元prim_id的求交结果t更新最近交点，valid为有效的掩码。
+    // 距离相同时取引用小的图元，与标量版本的结果一致
+    void update(vfloat valid, vfloat t, uint32_t prim_id) {
+        vfloat pid = splat_uint(prim_id);
+        vfloat closer = valid & (t > vfloat(0.0f)) & ((t < s) | ((t == s) & less_uint(pid, id)));
+        s = select(closer, t, s);
+        id = select(closer, pid, id);
+    }
+
+    // 取出每条光线的图元引用
+    void get_ids(uint32_t *ids) const {
+        float values[PACKET_SIZE];
+        id.store(values);
+        memcpy(ids, values, sizeof(values));
+    }
+};
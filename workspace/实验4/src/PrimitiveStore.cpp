@@ -0,0 +1,132 @@
+#include "PrimitiveStore.h"
+
+void Mesh::build(SThreadPool::ThreadPool *pool) {
+    vector<AABB> boxes;
+    bounds = AABB();
+    for (const auto &triangle : triangles) {
+        boxes.push_back(triangle.get_bounds());
+        bounds.expand(boxes.back());
+    }
+    // 完整扫描的构建时间是O(n log^2 n)，大网格改用分桶构建
+    bool large = triangles.size() >= compressed_min_triangles;
+    bvh.build(boxes, large ? BVH_BINNED_SAH : BVH_SWEEP_SAH, pool);
+    // 不能压缩时（见CompressedBVH::build）保留二叉BVH
+    if (large && compressed.build(bvh, triangles)) {
+        bvh = BVH();
+        // 构造交点所需的数据都在compressed中
+        triangles = vector<Triange>();
+    }
+}
+
+Mesh Mesh::box(vec3 lo, vec3 hi, uint32_t mat) {
+    Mesh mesh;
+    mesh.add_quad(vec3(lo.x, lo.y, hi.z), vec3(hi.x, lo.y, hi.z), vec3(hi.x, hi.y, hi.z), vec3(lo.x, hi.y, hi.z), mat);
+    mesh.add_quad(vec3(hi.x, lo.y, lo.z), vec3(lo.x, lo.y, lo.z), vec3(lo.x, hi.y, lo.z), vec3(hi.x, hi.y, lo.z), mat);
+    mesh.add_quad(vec3(hi.x, lo.y, hi.z), vec3(hi.x, lo.y, lo.z), vec3(hi.x, hi.y, lo.z), vec3(hi.x, hi.y, hi.z), mat);
+    mesh.add_quad(vec3(lo.x, lo.y, lo.z), vec3(lo.x, lo.y, hi.z), vec3(lo.x, hi.y, hi.z), vec3(lo.x, hi.y, lo.z), mat);
+    mesh.add_quad(vec3(lo.x, hi.y, hi.z), vec3(hi.x, hi.y, hi.z), vec3(hi.x, hi.y, lo.z), vec3(lo.x, hi.y, lo.z), mat);
+    mesh.add_quad(vec3(lo.x, lo.y, lo.z), vec3(hi.x, lo.y, lo.z), vec3(hi.x, lo.y, hi.z), vec3(lo.x, lo.y, hi.z), mat);
+    return mesh;
+}
+
+float Mesh::distance(const Ray &ray, float t_max, uint32_t &triangle) const {
+    if (!compressed.empty())
+        return compressed.closest(ray, t_max, triangle);
+    float best = -1;
+    // 与场景的最近交点相同，距离相同时取下标小的三角形
+    bvh.closest(ray, t_max, [&](uint32_t i) {
+        float s = triangles[i].distance(ray);
+        if (s > 0 && s <= t_max && (best < 0 || s < best || (s == best && i < triangle))) {
+            best = s;
+            triangle = i;
+        }
+        return best < 0 ? t_max : best;
+    });
+    return best;
+}
+
+bool Mesh::occludes(const Ray &ray, float t_max) const {
+    if (!compressed.empty())
+        return compressed.any(ray, t_max);
+    return bvh.any(ray, t_max, [&](uint32_t i) { return triangles[i].occludes(ray, t_max); });
+}
+
+void Mesh::finalize_hit(uint32_t triangle, const Ray &ray, Hit &hit) const {
+    if (!compressed.empty()) {
+        compressed.finalize_hit(triangle, ray, hit);
+        triangle = compressed.triangle_index(triangle);
+    } else {
+        triangles[triangle].finalize_hit(ray, hit);
+    }
+    if (vertex_indices.empty())
+        return;
+    // hit.uv是重心坐标，三个顶点的权重依次为u、v、1 - u - v
+    const uint32_t *v = &vertex_indices[3 * triangle];
+    float w1 = hit.uv.x, w2 = hit.uv.y, w3 = 1 - w1 - w2;
+    if (!normals.empty()) {
+        vec3 normal = normals[v[0]] * w1 + normals[v[1]] * w2 + normals[v[2]] * w3;
+        if (dot(normal, normal) > 0)
+            hit.normal = normalize(normal);
+    }
+    if (!uvs.empty())
+        hit.uv = uvs[v[0]] * w1 + uvs[v[1]] * w2 + uvs[v[2]] * w3;
+}
+
+Hit PrimitiveStore::finalize_hit(uint32_t ref, uint32_t element, const Ray &ray, float s) const {
+    Hit hit;
+    hit.s = s;
+    uint32_t index = primitive_index(ref);
+    switch (primitive_type(ref)) {
+    case PRIM_SPHERE:
+        spheres[index].finalize_hit(ray, hit);
+        break;
+    case PRIM_TRIANGLE:
+        triangles[index].finalize_hit(ray, hit);
+        break;
+    case PRIM_PLANE:
+        planes[index].finalize_hit(ray, hit);
+        break;
+    default: {
+        const Instance &instance = instances[index];
+        meshes[instance.mesh].finalize_hit(element, instance.to_object(ray), hit);
+        // 交点直接用世界空间的光线计算，法线按逆矩阵的转置变换回世界空间
+        hit.position = ray.start + ray.dir * hit.s;
+        hit.normal = normalize(transform_normal(hit.normal, instance.world_to_object));
+        hit.uv_lod += instance.lod_bias;
+        break;
+    }
+    }
+    return hit;
+}
+
+void PrimitiveStore::intersect_instance_packet(const Instance &instance, const RayPacket &packet, PacketHit &hit,
+                                               uint32_t id) const {
+    float start[3][PACKET_SIZE], dir[3][PACKET_SIZE], s[PACKET_SIZE], t[PACKET_SIZE];
+    packet.start.x.store(start[0]);
+    packet.start.y.store(start[1]);
+    packet.start.z.store(start[2]);
+    packet.dir.x.store(dir[0]);
+    packet.dir.y.store(dir[1]);
+    packet.dir.z.store(dir[2]);
+    hit.s.store(s);
+    const Mesh &mesh = meshes[instance.mesh];
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        Ray ray;
+        ray.start = vec3(start[0][i], start[1][i], start[2][i]);
+        ray.dir = vec3(dir[0][i], dir[1][i], dir[2][i]);
+        uint32_t triangle = 0;
+        t[i] = mesh.distance(instance.to_object(ray), s[i], triangle);
+    }
+    vfloat distance = vfloat::load(t);
+    hit.update(distance > vfloat(0.0f), distance, id);
+}
+
+AABB PrimitiveStore::get_instance_bounds(const Instance &instance) const {
+    const AABB &box = meshes[instance.mesh].bounds;
+    AABB result;
+    for (int i = 0; i < 8; i++) {
+        vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+        result.expand(transform_point(corner, instance.object_to_world));
+    }
+    return result;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "BVH.h"
+#include "CompressedBVH.h"
+#include "Intersectable.h"
+
+#include <vector>
+
+//---------------------------
+// 网格（底层加速结构）：物体空间中的三角形和它们的BVH，只存一份，可以被多个实例引用
+struct Mesh {
+    // 三角形不少于这个数的网格用压缩的4叉BVH遍历，不再保留二叉BVH和完整的三角形
+    static const size_t compressed_min_triangles = 4096;
+
+    vector<Triange> triangles; // 完整的三角形，压缩后清空
+    BVH bvh;                   // 叶子中是三角形下标
+    CompressedBVH compressed;  // 大网格的遍历结构，非空时代替bvh
+    AABB bounds;
+    // 可选的顶点属性（如从glTF读入的网格）：每个三角形3个顶点在normals和uvs中的下标。
+    // 为空时交点的法线是三角形的面法线，uv是重心坐标
+    vector<uint32_t> vertex_indices;
+    vector<vec3> normals; // 顶点法线，长度为0的法线表示没有，用面法线
+    vector<vec2> uvs;
+
+    void add_triangle(vec3 a, vec3 b, vec3 c, uint32_t mat) { triangles.emplace_back(a, b, c, mat); }
+    void add_quad(vec3 a, vec3 b, vec3 c, vec3 d, uint32_t mat) {
+        add_triangle(a, b, c, mat);
+        add_triangle(c, d, a, mat);
+    }
+    // 三角形添加完毕后建立BVH，大网格再压缩成4叉BVH。大网格分桶构建，给了线程池时并行构建
+    void build(SThreadPool::ThreadPool *pool = nullptr);
+    size_t triangle_count() const { return compressed.empty() ? triangles.size() : compressed.triangle_count(); }
+    // 以lo、hi为对角顶点的长方体，每个面两个三角形，法线朝外
+    static Mesh box(vec3 lo, vec3 hi, uint32_t mat);
+
+    // 物体空间中求最近交点的距离，只考虑距离不超过t_max的交点；无交点返回负数。
+    // triangle为命中的三角形，压缩的网格中是它在CompressedBVH叶子数组中的位置，只用于传给finalize_hit
+    float distance(const Ray &ray, float t_max, uint32_t &triangle) const;
+    bool occludes(const Ray &ray, float t_max) const;
+    // 物体空间中distance给出的三角形上交点的完整信息，有顶点属性时插值法线和uv
+    void finalize_hit(uint32_t triangle, const Ray &ray, Hit &hit) const;
+    size_t get_size_bytes() const {
+        return triangles.size() * sizeof(Triange) + bvh.get_size_bytes() + compressed.get_size_bytes() +
+               vertex_indices.size() * sizeof(uint32_t) + normals.size() * sizeof(vec3) + uvs.size() * sizeof(vec2);
+    }
+};
+
+//---------------------------
+// 网格的实例：用mat4（行向量约定）把网格从物体空间放到世界空间。
+// 求交时把光线变换到物体空间，方向不归一化，物体空间中的距离与世界空间相同
+struct Instance {
+    mat4 object_to_world, world_to_object;
+    uint32_t mesh;
+    float lod_bias; // 变换改变三角形面积后对uv_lod的修正
+
+    Instance(uint32_t _mesh, const mat4 &transform)
+        : object_to_world(transform), world_to_object(inverse_affine(transform)), mesh(_mesh) {
+        // 面积按|det|^(2/3)缩放
+        lod_bias = -log2f(fabsf(determinant3(transform))) / 3;
+    }
+
+    Ray to_object(const Ray &ray) const {
+        Ray result;
+        result.start = transform_point(ray.start, world_to_object);
+        result.dir = transform_vector(ray.dir, world_to_object);
+        return result;
+    }
+};
+
+//---------------------------
+// 场景中所有图元，每种类型一个连续数组。实例是顶层BVH中的一种图元，引用meshes中的网格
+struct PrimitiveStore {
+    vector<Sphere> spheres;
+    vector<Triange> triangles;
+    vector<Plane> planes;
+    vector<Mesh> meshes;
+    vector<Instance> instances;
+
+    // 按引用对单个图元求交，只求距离，无交点返回负数。实例只考虑距离不超过t_max的交点，
+    // element为命中的网格中三角形的下标，其他图元不修改element
+    float distance(uint32_t ref, const Ray &ray, float t_max, uint32_t &element) const {
+        uint32_t index = primitive_index(ref);
+        switch (primitive_type(ref)) {
+        case PRIM_SPHERE:
+            return spheres[index].distance(ray);
+        case PRIM_TRIANGLE:
+            return triangles[index].distance(ray);
+        case PRIM_PLANE:
+            return planes[index].distance(ray);
+        default: {
+            const Instance &instance = instances[index];
+            return meshes[instance.mesh].distance(instance.to_object(ray), t_max, element);
+        }
+        }
+    }
+    // 由distance的结果（距离s和element）构造最近交点的完整信息
+    Hit finalize_hit(uint32_t ref, uint32_t element, const Ray &ray, float s) const;
+    bool occludes(uint32_t ref, const Ray &ray, float t_max) const {
+        uint32_t index = primitive_index(ref);
+        switch (primitive_type(ref)) {
+        case PRIM_SPHERE:
+            return spheres[index].occludes(ray, t_max);
+        case PRIM_TRIANGLE:
+            return triangles[index].occludes(ray, t_max);
+        case PRIM_PLANE:
+            return planes[index].occludes(ray, t_max);
+        default: {
+            const Instance &instance = instances[index];
+            return meshes[instance.mesh].occludes(instance.to_object(ray), t_max);
+        }
+        }
+    }
+    void intersect_packet(uint32_t ref, const RayPacket &packet, PacketHit &hit) const {
+        uint32_t index = primitive_index(ref);
+        switch (primitive_type(ref)) {
+        case PRIM_SPHERE:
+            spheres[index].intersect_packet(packet, hit, ref);
+            break;
+        case PRIM_TRIANGLE:
+            triangles[index].intersect_packet(packet, hit, ref);
+            break;
+        case PRIM_PLANE:
+            planes[index].intersect_packet(packet, hit, ref);
+            break;
+        default:
+            intersect_instance_packet(instances[index], packet, hit, ref);
+            break;
+        }
+    }
+
+    // 实例内部逐条光线求交
+    void intersect_instance_packet(const Instance &instance, const RayPacket &packet, PacketHit &hit,
+                                   uint32_t id) const;
+    // 实例在世界空间中的包围盒
+    AABB get_instance_bounds(const Instance &instance) const;
+};
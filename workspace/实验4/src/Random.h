@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+
+//---------------------------
+// PCG32随机数发生器（PCG-XSH-RR），64位状态，输出32位。
+// 同一个seed下不同的sequence产生互不相关的序列，路径追踪按(帧, 像素)播种，结果可以复现
+struct PCG32 {
+    uint64_t state = 0x853c49e6748fea9bULL;
+    uint64_t inc = 0xda3e39cb94b95bdbULL;
+
+    PCG32() {}
+    PCG32(uint64_t seed, uint64_t sequence) {
+        state = 0;
+        inc = (sequence << 1) | 1;
+        next_uint();
+        state += seed;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+        uint32_t rot = (uint32_t)(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // [0, 1)之间均匀分布的浮点数，取高24位保证不会等于1
+    float next_float() { return (next_uint() >> 8) * (1.0f / 16777216.0f); }
+
+    // 跳过delta个数，用时与log(delta)成正比
+    void advance(uint64_t delta) {
+        uint64_t cur_mult = 6364136223846793005ULL, cur_plus = inc;
+        uint64_t acc_mult = 1, acc_plus = 0;
+        while (delta > 0) {
+            if (delta & 1) {
+                acc_mult *= cur_mult;
+                acc_plus = acc_plus * cur_mult + cur_plus;
+            }
+            cur_plus = (cur_mult + 1) * cur_plus;
+            cur_mult *= cur_mult;
+            delta >>= 1;
+        }
+        state = acc_mult * state + acc_plus;
+    }
+};
@@ -1,110 +1,412 @@
 #pragma once
 
-#include "winapi.h"
-
 #include <assert.h>
-#include <deque>
-#include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
 #include <iostream>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 // 线程池
 namespace SThreadPool {
 
+// 任务队列的容量，必须是2的幂
 #define TASK_BUFFER_SIZE 128
 
-static DWORD get_core_number() {
-    SYSTEM_INFO sysInfo;
-    // 获取系统信息，
-    // SYSTEM_INFO结构体中可获取当前系统的逻辑处理器的个数
-    GetSystemInfo(&sysInfo);
-    return sysInfo.dwNumberOfProcessors;
+static size_t get_core_number() {
+    // 获取逻辑处理器的个数，无法获取时按1个处理
+    size_t count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : count;
 }
 
-using Task = std::function<void()>;
+//---------------------------
+// 无返回值的任务，只能移动不能复制。
+// 捕获的数据不超过inline_size时直接存放在任务内部，不分配内存；更大的才放到堆上
+class Task {
+public:
+    static const size_t inline_size = 48;
+
+    Task() {}
+    Task(std::nullptr_t) {}
+
+    template <typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, Task>::value>>
+    Task(Fn &&fn) {
+        using F = std::decay_t<Fn>;
+        if constexpr (sizeof(F) <= inline_size && alignof(F) <= alignof(std::max_align_t) &&
+                      std::is_nothrow_move_constructible<F>::value) {
+            new (storage) F(std::forward<Fn>(fn));
+            ops = &inline_ops<F>;
+        } else {
+            new (storage) F *(new F(std::forward<Fn>(fn)));
+            ops = &heap_ops<F>;
+        }
+    }
+
+    Task(Task &&other) noexcept { move_from(other); }
+
+    Task &operator=(Task &&other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+
+    Task &operator=(std::nullptr_t) {
+        reset();
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() { reset(); }
+
+    void operator()() { ops->invoke(storage); }
+    explicit operator bool() const { return ops != nullptr; }
+
+private:
+    // 对存放在storage中的可调用对象的操作
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src); // 移动到dst并销毁src
+        void (*destroy)(void *storage);
+    };
+
+    template <typename F> static F &inline_fn(void *storage) { return *(F *)storage; }
+    template <typename F> static F *&heap_fn(void *storage) { return *(F **)storage; }
+
+    template <typename F> static constexpr Ops inline_ops = {
+        [](void *storage) { inline_fn<F>(storage)(); },
+        [](void *dst, void *src) {
+            new (dst) F(std::move(inline_fn<F>(src)));
+            inline_fn<F>(src).~F();
+        },
+        [](void *storage) { inline_fn<F>(storage).~F(); },
+    };
+
+    // 堆上的对象只需要移动指针
+    template <typename F> static constexpr Ops heap_ops = {
+        [](void *storage) { (*heap_fn<F>(storage))(); },
+        [](void *dst, void *src) { new (dst) F *(heap_fn<F>(src)); },
+        [](void *storage) { delete heap_fn<F>(storage); },
+    };
+
+    void move_from(Task &other) {
+        ops = other.ops;
+        if (ops != nullptr)
+            ops->move(storage, other.storage);
+        other.ops = nullptr;
+    }
+
+    void reset() {
+        if (ops != nullptr)
+            ops->destroy(storage);
+        ops = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+    const Ops *ops = nullptr;
+};
+
+//---------------------------
+// 有界的多生产者多消费者无锁队列。
+// 每个格子带一个序号，生产者和消费者各自用CAS抢占位置，序号表示格子当前可写还是可读
+class TaskQueue {
+public:
+    TaskQueue() {
+        static_assert((TASK_BUFFER_SIZE & (TASK_BUFFER_SIZE - 1)) == 0, "TASK_BUFFER_SIZE must be a power of 2");
+        for (size_t i = 0; i < TASK_BUFFER_SIZE; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // 队列满时返回false，此时task不会被移走
+    bool push(Task &task) {
+        size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[pos & (TASK_BUFFER_SIZE - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(pos, pos + 1))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->task = std::move(task);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 队列空时返回false
+    bool pop(Task &task) {
+        size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells[pos & (TASK_BUFFER_SIZE - 1)];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos.compare_exchange_weak(pos, pos + 1))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        task = std::move(cell->task);
+        cell->sequence.store(pos + TASK_BUFFER_SIZE, std::memory_order_release);
+        return true;
+    }
+
+    // 队列是否可能为空，并发时只作为是否有任务的提示
+    bool maybe_empty() const { return enqueue_pos.load() == dequeue_pos.load(); }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Task task;
+    };
+
+    Cell cells[TASK_BUFFER_SIZE];
+    // 生产者和消费者的位置放在不同的缓存行，避免互相干扰
+    alignas(64) std::atomic<size_t> enqueue_pos{0};
+    alignas(64) std::atomic<size_t> dequeue_pos{0};
+};
 
 class ThreadPool {
 public:
     ThreadPool(size_t thread_num = 0) {
         thread_num = thread_num == 0 ? get_core_number() : thread_num;
         std::cout << "ThreadPool: " << thread_num << std::endl;
-        task_queue_access_mutex = CreateMutex(NULL, false, NULL);
-        assert(task_queue_access_mutex != INVALID_HANDLE_VALUE);
-        semaphore_task_count = CreateSemaphore(NULL, 0, TASK_BUFFER_SIZE, NULL);
-        assert(semaphore_task_count != INVALID_HANDLE_VALUE);
-        semaphore_task_available = CreateSemaphore(NULL, TASK_BUFFER_SIZE, TASK_BUFFER_SIZE, NULL);
-        assert(semaphore_task_available != INVALID_HANDLE_VALUE);
-        task_complete_event = CreateEvent(NULL, true, true, NULL);
-        assert(task_complete_event != INVALID_HANDLE_VALUE);
-
-        // 先创建锁再创建线程不能反过来。。。。
+
         threads.reserve(thread_num);
-        for (size_t i = 0; i < thread_num; ++i) {
-            HANDLE thread = CreateThread(NULL, 0, thread_cycle, this, 0, NULL);
-            assert(thread != INVALID_HANDLE_VALUE);
-            threads.push_back(thread);
-        }
+        for (size_t i = 0; i < thread_num; ++i)
+            threads.emplace_back([this] { thread_cycle(); });
     }
 
-    // 添加待执行任务并立即开始执行
+    // 添加待执行任务并立即开始执行。
+    // 队列满时由调用线程帮忙执行已有的任务，直到能放进去为止
     void add_task(Task &&task) {
-        ResetEvent(task_complete_event);
-        // std::cout << "WaitForSingleObject: " << ret << std::endl;
-        WaitForSingleObject(semaphore_task_available, INFINITE);
-        WaitForSingleObject(task_queue_access_mutex, INFINITE);
-        tasks.push_back(std::move(task));
-        ReleaseMutex(task_queue_access_mutex);
-        ReleaseSemaphore(semaphore_task_count, 1, NULL);
+        pending.fetch_add(1);
+        while (!tasks.push(task)) {
+            Task other;
+            if (tasks.pop(other))
+                execute(other);
+            else
+                std::this_thread::yield();
+        }
+        // 只有存在休眠的线程时才需要加锁唤醒
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            task_available.notify_one();
+        }
+    }
+
+    // 线程数量
+    size_t thread_count() const { return threads.size(); }
+
+    // 从队列中取一个任务在调用线程上执行，队列为空时返回false。
+    // 等待其他任务时用它代替休眠，任务中嵌套等待也不会死锁
+    bool run_pending_task() {
+        Task task;
+        if (!tasks.pop(task))
+            return false;
+        execute(task);
+        return true;
     }
 
-    // 等待所有任务执行完毕
+    // 队列中没有待执行的任务，说明有线程可能空闲，值得继续拆分工作
+    bool is_hungry() const { return tasks.maybe_empty(); }
+
+    // 等待所有任务执行完毕，等待期间调用线程也会执行队列中的任务。
+    // 在任务内部调用会等待自己，因此任务中需要并行时应使用parallel_for
     void wait_for_all_done() {
-        WaitForSingleObject(task_complete_event, INFINITE);
-        assert(tasks.size() == 0);
+        while (pending.load() > 0) {
+            Task task;
+            if (tasks.pop(task)) {
+                execute(task);
+                continue;
+            }
+            // 剩下的任务都在其他线程上执行
+            std::unique_lock<std::mutex> lock(done_mutex);
+            all_done.wait(lock, [this] { return pending.load() == 0; });
+        }
     }
 
     ~ThreadPool() {
         wait_for_all_done();
-        for (auto thread : threads) {
-            TerminateThread(thread, 0);
-            CloseHandle(thread);
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stop = true;
+            task_available.notify_all();
         }
-        CloseHandle(task_queue_access_mutex);
-        CloseHandle(task_complete_event);
-        CloseHandle(semaphore_task_available);
-        CloseHandle(semaphore_task_count);
+        for (auto &thread : threads)
+            thread.join();
     }
 
 private:
-    std::vector<HANDLE> threads;
-    std::deque<Task> tasks;
+    std::vector<std::thread> threads;
+    TaskQueue tasks;
 
-    HANDLE task_queue_access_mutex;  // 访问task_queue的锁
-    HANDLE task_complete_event;      // 任务执行完毕的事件
-    HANDLE semaphore_task_available; // task_queue是否有任务可执行的信号
-    HANDLE semaphore_task_count;     // task_queue中任务数量的信号
+    std::atomic<size_t> pending{0}; // 已添加但还没执行完的任务数
+    std::atomic<int> sleeping{0};   // 正在休眠等待任务的线程数
+    bool stop = false;              // 析构时通知线程退出，由sleep_mutex保护
 
-    static DWORD WINAPI thread_cycle(void *arg) {
-        ThreadPool &pool = *(ThreadPool *)arg;
-        while (true) {
-            WaitForSingleObject(pool.semaphore_task_count, INFINITE);
-            WaitForSingleObject(pool.task_queue_access_mutex, INFINITE);
+    std::mutex sleep_mutex;                 // 线程休眠用的锁，添加任务时不需要
+    std::condition_variable task_available; // 有新任务
+    std::mutex done_mutex;
+    std::condition_variable all_done; // 任务执行完毕
 
-            assert(pool.tasks.size() > 0);
-            Task t = pool.tasks.front();
-            pool.tasks.pop_front();
-            bool is_empty = pool.tasks.empty();
-            ReleaseMutex(pool.task_queue_access_mutex);
+    // 休眠前先自旋的次数，任务连续到来时不必进入内核
+    static const int spin_count = 64;
 
-            t(); // 执行任务
+    void execute(Task &task) {
+        task(); // 执行任务
+        if (pending.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(done_mutex);
+            all_done.notify_all();
+        }
+    }
 
-            ReleaseSemaphore(pool.semaphore_task_available, 1, NULL);
-            if (is_empty && pool.tasks.empty()) {
-                SetEvent(pool.task_complete_event);
+    void thread_cycle() {
+        Task task;
+        int idle = 0;
+        while (true) {
+            if (tasks.pop(task)) {
+                execute(task);
+                idle = 0;
+                continue;
+            }
+            if (++idle < spin_count) {
+                std::this_thread::yield();
+                continue;
             }
+            // 先登记为休眠再检查队列，add_task要么看到休眠的线程并唤醒，要么任务已经能被这里看到
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping.fetch_add(1);
+            while (!stop && tasks.maybe_empty())
+                task_available.wait(lock);
+            sleeping.fetch_sub(1);
+            if (stop)
+                return;
+            idle = 0;
+        }
+    }
+};
+
+//---------------------------
+// 一组任务的计数，等待时调用线程执行队列中的任务而不是休眠
+class TaskGroup {
+public:
+    TaskGroup(ThreadPool &_pool) : pool(_pool) {}
+
+    template <typename Fn> void run(Fn &&fn) {
+        pending.fetch_add(1);
+        pool.add_task([this, fn = std::forward<Fn>(fn)]() mutable {
+            fn();
+            // 计数归零后等待的线程可能立即销毁this，之后不能再访问成员
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+
+    void wait() {
+        while (pending.load(std::memory_order_acquire) > 0) {
+            if (!pool.run_pending_task())
+                std::this_thread::yield();
         }
-        return 0;
     }
+
+    ThreadPool &get_pool() { return pool; }
+
+private:
+    ThreadPool &pool;
+    std::atomic<size_t> pending{0};
 };
 
-} // namespace SThreadPool
\ No newline at end of file
+namespace detail {
+
+// 自适应拆分：按grain大小逐块执行[begin, end)，每执行一块前检查线程池是否有空闲，
+// 有空闲时把剩余部分的后一半作为新任务交出去。make_piece()为每段连续执行的区间创建一个执行者，
+// 执行者的run(b, e)处理一块，finish()在这段结束时调用
+template <typename MakePiece>
+void split_range(TaskGroup &group, size_t begin, size_t end, size_t grain, const MakePiece &make_piece) {
+    auto piece = make_piece();
+    ThreadPool &pool = group.get_pool();
+    while (end - begin > grain) {
+        if (pool.thread_count() > 0 && pool.is_hungry()) {
+            size_t mid = begin + (end - begin) / 2;
+            group.run([&group, mid, end, grain, &make_piece] { split_range(group, mid, end, grain, make_piece); });
+            end = mid;
+            continue;
+        }
+        piece.run(begin, begin + grain);
+        begin += grain;
+    }
+    if (begin < end)
+        piece.run(begin, end);
+    piece.finish();
+}
+
+} // namespace detail
+
+// 并行执行fn(b, e)，所有调用的[b, e)恰好覆盖[begin, end)，每段长度不超过grain。
+// 调用线程也参与执行，可以在线程池的任务中嵌套调用
+template <typename Fn> void parallel_for(ThreadPool &pool, size_t begin, size_t end, size_t grain, const Fn &fn) {
+    if (begin >= end)
+        return;
+    grain = grain == 0 ? 1 : grain;
+    struct Piece {
+        const Fn &fn;
+        void run(size_t b, size_t e) { fn(b, e); }
+        void finish() {}
+    };
+    TaskGroup group(pool);
+    // split_range产生的任务引用make_piece，它必须活到group.wait()之后
+    auto make_piece = [&fn] { return Piece{fn}; };
+    detail::split_range(group, begin, end, grain, make_piece);
+    group.wait();
+}
+
+// 并行归约：每段连续执行的区间从identity开始，依次value = fn(b, e, value)，
+// 各段的结果再用combine合并。combine需要满足结合律和交换律
+template <typename T, typename Fn, typename Combine>
+T parallel_reduce(ThreadPool &pool, size_t begin, size_t end, size_t grain, const T &identity, const Fn &fn,
+                  const Combine &combine) {
+    if (begin >= end)
+        return identity;
+    grain = grain == 0 ? 1 : grain;
+    struct Result {
+        std::mutex mutex;
+        T value;
+    } result{{}, identity};
+    struct Piece {
+        const Fn &fn;
+        const Combine &combine;
+        Result &result;
+        T value;
+        void run(size_t b, size_t e) { value = fn(b, e, value); }
+        void finish() {
+            std::lock_guard<std::mutex> lock(result.mutex);
+            result.value = combine(result.value, value);
+        }
+    };
+    TaskGroup group(pool);
+    auto make_piece = [&fn, &combine, &result, &identity] { return Piece{fn, combine, result, identity}; };
+    detail::split_range(group, begin, end, grain, make_piece);
+    group.wait();
+    return result.value;
+}
+
+} // namespace SThreadPool
@@ -0,0 +1,220 @@
+#include "Sampler.h"
+#include "Random.h"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+// 整数哈希，把像素坐标、维度等打散
+static uint32_t hash_uint(uint32_t v) {
+    v ^= v >> 16;
+    v *= 0x7feb352d;
+    v ^= v >> 15;
+    v *= 0x846ca68b;
+    v ^= v >> 16;
+    return v;
+}
+
+static uint32_t hash_combine(uint32_t seed, uint32_t v) {
+    return seed ^ (v + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+}
+
+// 取32位无符号整数的高24位换算到[0, 1)
+static float to_unit_float(uint32_t v) { return (v >> 8) * (1.0f / 16777216.0f); }
+
+//---------------------------
+// Sobol序列
+
+static const uint32_t sobol_dimensions = 4;
+
+// 前4维的方向数（Joe & Kuo），第0维是van der Corput序列
+struct SobolDirections {
+    uint32_t v[sobol_dimensions][32];
+
+    SobolDirections() {
+        // 每一维的本原多项式次数s、系数a和初始值m
+        const uint32_t s[sobol_dimensions] = {0, 1, 2, 3};
+        const uint32_t a[sobol_dimensions] = {0, 0, 1, 1};
+        const uint32_t m[sobol_dimensions][3] = {{0, 0, 0}, {1, 0, 0}, {1, 3, 0}, {1, 3, 1}};
+        for (uint32_t i = 0; i < 32; i++)
+            v[0][i] = 1u << (31 - i);
+        for (uint32_t d = 1; d < sobol_dimensions; d++) {
+            for (uint32_t i = 0; i < s[d]; i++)
+                v[d][i] = m[d][i] << (31 - i);
+            for (uint32_t i = s[d]; i < 32; i++) {
+                v[d][i] = v[d][i - s[d]] ^ (v[d][i - s[d]] >> s[d]);
+                for (uint32_t k = 1; k < s[d]; k++)
+                    v[d][i] ^= ((a[d] >> (s[d] - 1 - k)) & 1) * v[d][i - k];
+            }
+        }
+    }
+};
+
+static const SobolDirections sobol_directions;
+
+static uint32_t sobol(uint32_t index, uint32_t dimension) {
+    uint32_t x = 0;
+    for (uint32_t bit = 0; index != 0; index >>= 1, bit++)
+        if (index & 1)
+            x ^= sobol_directions.v[dimension][bit];
+    return x;
+}
+
+static uint32_t reverse_bits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+// 基于哈希的Owen扰乱（Burley 2020）：每一位的翻转只取决于比它高的位，
+// 扰乱后的序列仍保持Sobol序列的分层性质
+static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x ^= x * 0x3d20adea;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56;
+    x ^= x * 0x53a22864;
+    return reverse_bits(x);
+}
+
+// 超过4维时每4维一组重复使用前4维，每组的样本序号用不同的种子打乱，组与组之间不相关
+static float sobol_owen(uint32_t index, uint32_t dimension, uint32_t seed) {
+    uint32_t group_seed = hash_combine(seed, hash_uint(dimension / sobol_dimensions));
+    uint32_t shuffled = nested_uniform_scramble(index, group_seed);
+    uint32_t d = dimension % sobol_dimensions;
+    return to_unit_float(nested_uniform_scramble(sobol(shuffled, d), hash_combine(group_seed, d + 1)));
+}
+
+//---------------------------
+// 蓝噪声
+
+static const uint32_t blue_noise_size = 64;
+
+// 用void-and-cluster方法（Ulichney 1993）生成blue_noise_size x blue_noise_size的排名表，
+// 每个排名出现一次，任取排名前k的像素都是均匀分散的点
+static std::vector<uint16_t> make_blue_noise() {
+    const int n = (int)blue_noise_size, count = n * n;
+    // 环面上的高斯核，表格平铺时边界处也是蓝噪声
+    const float sigma = 1.5f;
+    std::vector<float> kernel(count);
+    for (int dy = 0; dy < n; dy++) {
+        for (int dx = 0; dx < n; dx++) {
+            int wx = std::min(dx, n - dx), wy = std::min(dy, n - dy);
+            kernel[dy * n + dx] = expf(-(float)(wx * wx + wy * wy) / (2 * sigma * sigma));
+        }
+    }
+    std::vector<uint8_t> pattern(count, 0);
+    std::vector<float> energy(count, 0);
+    auto splat = [&](int p, float sign) {
+        int px = p % n, py = p / n;
+        for (int y = 0; y < n; y++) {
+            const float *row = &kernel[((y - py + n) % n) * n];
+            for (int x = 0; x < n; x++)
+                energy[y * n + x] += sign * row[(x - px + n) % n];
+        }
+    };
+    // 点最密集处（能量最大的点）和最空处（能量最小的空位）
+    auto tightest_cluster = [&]() {
+        int best = -1;
+        for (int p = 0; p < count; p++)
+            if (pattern[p] && (best < 0 || energy[p] > energy[best]))
+                best = p;
+        return best;
+    };
+    auto largest_void = [&]() {
+        int best = -1;
+        for (int p = 0; p < count; p++)
+            if (!pattern[p] && (best < 0 || energy[p] < energy[best]))
+                best = p;
+        return best;
+    };
+
+    // 初始图案：随机取十分之一的位置，再反复把最密集处的点移到最空处，直到不再移动
+    const int initial_count = count / 10;
+    PCG32 rng(1, 1);
+    for (int placed = 0; placed < initial_count;) {
+        int p = (int)(rng.next_uint() % count);
+        if (!pattern[p]) {
+            pattern[p] = 1;
+            splat(p, 1);
+            placed++;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        int cluster = tightest_cluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1);
+        int hole = largest_void();
+        pattern[hole] = 1;
+        splat(hole, 1);
+        if (hole == cluster)
+            break;
+    }
+
+    std::vector<uint16_t> ranks(count);
+    const std::vector<uint8_t> initial_pattern = pattern;
+    const std::vector<float> initial_energy = energy;
+    // 初始图案中的点按从密到疏依次移除，先移除的排名高
+    for (int rank = initial_count - 1; rank >= 0; rank--) {
+        int cluster = tightest_cluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1);
+        ranks[cluster] = (uint16_t)rank;
+    }
+    // 其余位置从初始图案开始依次填入最空处
+    pattern = initial_pattern;
+    energy = initial_energy;
+    for (int rank = initial_count; rank < count; rank++) {
+        int hole = largest_void();
+        pattern[hole] = 1;
+        splat(hole, 1);
+        ranks[hole] = (uint16_t)rank;
+    }
+    return ranks;
+}
+
+// 蓝噪声抖动采样（Georgiev & Fajardo 2016）：所有像素使用同一个Sobol序列，
+// 每个像素按蓝噪声表的值旋转（Cranley-Patterson，取模1）。每一维使用平移过的同一张表，
+// 同一像素的样本序列仍是低差异的，同一样本在相邻像素间的误差呈蓝噪声分布
+static float blue_noise(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension, uint32_t seed) {
+    static const std::vector<uint16_t> ranks = make_blue_noise();
+    const uint32_t mask = blue_noise_size - 1;
+    uint32_t h = hash_uint(hash_combine(seed, dimension));
+    x = (x + h) & mask;
+    y = (y + (h >> 16)) & mask;
+    float value = sobol_owen(index, dimension, seed) + (ranks[y * blue_noise_size + x] + 0.5f) / (float)ranks.size();
+    return value < 1.0f ? value : value - 1.0f;
+}
+
+//---------------------------
+
+const char *Sampler::get_name(SamplerType type) {
+    switch (type) {
+    case SAMPLER_INDEPENDENT:
+        return "independent";
+    case SAMPLER_SOBOL:
+        return "sobol";
+    case SAMPLER_BLUE_NOISE:
+        return "blue-noise";
+    }
+    return "unknown";
+}
+
+float Sampler::get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const {
+    switch (type) {
+    case SAMPLER_SOBOL:
+        return sobol_owen(index, dimension, hash_combine(seed, hash_uint(x + hash_uint(y))));
+    case SAMPLER_BLUE_NOISE:
+        return blue_noise(x, y, index, dimension, seed);
+    default: {
+        // 每个像素一个PCG32序列，按样本序号播种，跳到第dimension个数
+        PCG32 rng(hash_combine(seed, index), ((uint64_t)y << 32) | x);
+        rng.advance(dimension);
+        return rng.next_float();
+    }
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// 采样序列的类型
+enum SamplerType {
+    SAMPLER_INDEPENDENT, // 独立随机数（PCG32），白噪声
+    SAMPLER_SOBOL,       // Owen扰乱的Sobol序列，每个像素的样本序列是低差异的
+    SAMPLER_BLUE_NOISE   // 蓝噪声表格平铺在屏幕上，相邻像素的误差互补，样本间按黄金分割比旋转
+};
+
+//---------------------------
+// 采样器：按(像素, 样本序号, 维度)直接算出[0, 1)之间的样本值，没有内部状态，
+// 可以在多个线程中同时使用。seed不同时得到互不相关的另一组样本
+class Sampler {
+public:
+    Sampler(SamplerType _type = SAMPLER_SOBOL, uint32_t _seed = 0) : type(_type), seed(_seed) {}
+
+    SamplerType get_type() const { return type; }
+    uint32_t get_seed() const { return seed; }
+    static const char *get_name(SamplerType type);
+
+    float get(uint32_t x, uint32_t y, uint32_t index, uint32_t dimension) const;
+
+private:
+    SamplerType type;
+    uint32_t seed;
+};
+
+//---------------------------
+// 一个样本按顺序取用的各维，用法固定的随机数应该总是取同一维
+struct SampleStream {
+    const Sampler &sampler;
+    uint32_t x, y, index;
+    uint32_t dimension = 0;
+
+    SampleStream(const Sampler &_sampler, uint32_t _x, uint32_t _y, uint32_t _index, uint32_t _dimension = 0)
+        : sampler(_sampler), x(_x), y(_y), index(_index), dimension(_dimension) {}
+
+    float next() { return sampler.get(x, y, index, dimension++); }
+};
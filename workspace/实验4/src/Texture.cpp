@@ -0,0 +1,145 @@
+#include "Texture.h"
+#include "Material.h"
+
+#include <FreeImage.h>
+#include <algorithm>
+
+static uint32_t pack_rgba(uint32_t r, uint32_t g, uint32_t b, uint32_t a) { return r | (g << 8) | (b << 16) | (a << 24); }
+
+static vec3 unpack_rgb(uint32_t rgba) {
+    const float scale = 1.0f / 255.0f;
+    return vec3((rgba & 0xff) * scale, ((rgba >> 8) & 0xff) * scale, ((rgba >> 16) & 0xff) * scale);
+}
+
+// 重复寻址
+static uint32_t wrap(int32_t i, uint32_t n) {
+    int32_t m = i % (int32_t)n;
+    return (uint32_t)(m < 0 ? m + (int32_t)n : m);
+}
+
+Texture::Texture(FIBITMAP *bitmap) {
+    FIBITMAP *rgb = FreeImage_ConvertTo24Bits(bitmap);
+    uint32_t width = std::max(FreeImage_GetWidth(rgb), 1u), height = std::max(FreeImage_GetHeight(rgb), 1u);
+    add_level(width, height);
+    for (uint32_t y = 0; y < height; y++) {
+        for (uint32_t x = 0; x < width; x++) {
+            RGBQUAD color;
+            FreeImage_GetPixelColor(rgb, x, y, &color);
+            store(levels[0], x, y, pack_rgba(color.rgbRed, color.rgbGreen, color.rgbBlue, 255));
+        }
+    }
+    FreeImage_Unload(rgb);
+    log2_size = 0.5f * log2f((float)width * height);
+
+    // 逐层2x2平均生成mipmap，奇数边长时最后一行/列重复使用
+    while (width > 1 || height > 1) {
+        uint32_t w = std::max(width / 2, 1u), h = std::max(height / 2, 1u);
+        add_level(w, h);
+        const Level &src = levels[levels.size() - 2], &dst = levels.back();
+        for (uint32_t y = 0; y < h; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                uint32_t x0 = std::min(2 * x, width - 1), x1 = std::min(2 * x + 1, width - 1);
+                uint32_t y0 = std::min(2 * y, height - 1), y1 = std::min(2 * y + 1, height - 1);
+                uint32_t c[4] = {fetch(src, x0, y0), fetch(src, x1, y0), fetch(src, x0, y1), fetch(src, x1, y1)};
+                uint32_t sum[4] = {0, 0, 0, 0};
+                for (uint32_t k = 0; k < 4; k++)
+                    for (uint32_t channel = 0; channel < 4; channel++)
+                        sum[channel] += (c[k] >> (8 * channel)) & 0xff;
+                store(dst, x, y, pack_rgba((sum[0] + 2) / 4, (sum[1] + 2) / 4, (sum[2] + 2) / 4, (sum[3] + 2) / 4));
+            }
+        }
+        width = w;
+        height = h;
+    }
+}
+
+Texture Texture::load(const std::string &path) {
+    FIBITMAP *bitmap = freeimage_load_and_convert_image(path);
+    Texture texture(bitmap);
+    FreeImage_Unload(bitmap);
+    return texture;
+}
+
+void Texture::add_level(uint32_t width, uint32_t height) {
+    Level level;
+    level.width = width;
+    level.height = height;
+    level.tiles_x = (width + tile_size - 1) / tile_size;
+    level.offset = texels.size();
+    uint32_t tiles_y = (height + tile_size - 1) / tile_size;
+    texels.resize(texels.size() + (size_t)level.tiles_x * tiles_y * tile_size * tile_size);
+    levels.push_back(level);
+}
+
+vec3 Texture::nearest(const Level &level, vec2 uv) const {
+    int32_t x = (int32_t)floorf(uv.x * level.width), y = (int32_t)floorf(uv.y * level.height);
+    return unpack_rgb(fetch(level, wrap(x, level.width), wrap(y, level.height)));
+}
+
+vec3 Texture::bilinear(const Level &level, vec2 uv) const {
+    // 纹素中心在半整数坐标上
+    float fx = uv.x * level.width - 0.5f, fy = uv.y * level.height - 0.5f;
+    float x0f = floorf(fx), y0f = floorf(fy);
+    float tx = fx - x0f, ty = fy - y0f;
+    uint32_t x0 = wrap((int32_t)x0f, level.width), x1 = wrap((int32_t)x0f + 1, level.width);
+    uint32_t y0 = wrap((int32_t)y0f, level.height), y1 = wrap((int32_t)y0f + 1, level.height);
+    vec3 bottom = unpack_rgb(fetch(level, x0, y0)) * (1 - tx) + unpack_rgb(fetch(level, x1, y0)) * tx;
+    vec3 top = unpack_rgb(fetch(level, x0, y1)) * (1 - tx) + unpack_rgb(fetch(level, x1, y1)) * tx;
+    return bottom * (1 - ty) + top * ty;
+}
+
+vec3 Texture::sample(vec2 uv, float lod, TextureFilter filter) const {
+    float max_lod = (float)(levels.size() - 1);
+    lod = std::min(std::max(lod, 0.0f), max_lod);
+    switch (filter) {
+    case TEXTURE_NEAREST:
+        return nearest(levels[0], uv);
+    case TEXTURE_BILINEAR:
+        return bilinear(levels[(size_t)(lod + 0.5f)], uv);
+    default: {
+        uint32_t level = (uint32_t)lod;
+        float t = lod - level;
+        vec3 color = bilinear(levels[level], uv);
+        if (t > 0)
+            color = color * (1 - t) + bilinear(levels[level + 1], uv) * t;
+        return color;
+    }
+    }
+}
+
+TextureCache &TextureCache::instance() {
+    static TextureCache cache;
+    return cache;
+}
+
+std::shared_ptr<const Texture> TextureCache::get(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests++;
+    auto &texture = textures[path];
+    if (texture == nullptr) {
+        texture = std::make_shared<Texture>(Texture::load(path));
+        loads++;
+    }
+    return texture;
+}
+
+void TextureCache::clear_unused() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = textures.begin(); it != textures.end();) {
+        if (it->second.use_count() == 1)
+            it = textures.erase(it);
+        else
+            ++it;
+    }
+}
+
+TextureCacheStats TextureCache::get_stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    TextureCacheStats stats;
+    stats.requests = requests;
+    stats.loads = loads;
+    stats.resident = (uint32_t)textures.size();
+    for (const auto &entry : textures)
+        stats.resident_bytes += entry.second->get_size_bytes();
+    return stats;
+}
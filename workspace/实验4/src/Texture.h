@@ -0,0 +1,95 @@
+#pragma once
+
+#include "glmath.h"
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct FIBITMAP;
+
+// 纹理过滤方式
+enum TextureFilter {
+    TEXTURE_NEAREST,   // 最近的纹素，只用第0层
+    TEXTURE_BILINEAR,  // 在最接近footprint的一层上双线性插值
+    TEXTURE_TRILINEAR  // 在相邻两层上双线性插值后再按层插值
+};
+
+//---------------------------
+// 预先解码的纹理：加载时一次性转换成RGBA8并生成mipmap，采样时不再调用图片库。
+// 每层按8x8的块存放，块内逐行，双线性插值的4个纹素通常在同一个块（同一两条缓存行）里。
+// 纹理坐标按重复方式寻址
+class Texture {
+public:
+    static const uint32_t tile_size = 8;
+
+    // 从FreeImage位图（任意格式，内部转换为24位）构建
+    explicit Texture(FIBITMAP *bitmap);
+    // 加载图片文件，失败时退出程序（与freeimage_load_and_convert_image相同）
+    static Texture load(const std::string &path);
+
+    uint32_t get_width() const { return levels[0].width; }
+    uint32_t get_height() const { return levels[0].height; }
+    uint32_t get_level_count() const { return (uint32_t)levels.size(); }
+    // 所有层占用的字节数
+    size_t get_size_bytes() const { return texels.size() * sizeof(uint32_t); }
+    // 第0层纹素数的log2的一半，即uv面积为1的正方形边长上的纹素数的log2，用于由footprint求lod
+    float get_log2_size() const { return log2_size; }
+
+    // 按lod（mip层级，0为原图）采样
+    vec3 sample(vec2 uv, float lod, TextureFilter filter) const;
+
+private:
+    struct Level {
+        uint32_t width, height;
+        uint32_t tiles_x; // 每行的块数
+        size_t offset;    // 在texels中的起始下标
+    };
+
+    uint32_t fetch(const Level &level, uint32_t x, uint32_t y) const {
+        size_t tile = (size_t)(y / tile_size) * level.tiles_x + x / tile_size;
+        return texels[level.offset + tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size];
+    }
+    vec3 nearest(const Level &level, vec2 uv) const;
+    vec3 bilinear(const Level &level, vec2 uv) const;
+
+    void add_level(uint32_t width, uint32_t height);
+    void store(const Level &level, uint32_t x, uint32_t y, uint32_t rgba) {
+        size_t tile = (size_t)(y / tile_size) * level.tiles_x + x / tile_size;
+        texels[level.offset + tile * tile_size * tile_size + (y % tile_size) * tile_size + x % tile_size] = rgba;
+    }
+
+    std::vector<Level> levels;
+    std::vector<uint32_t> texels; // RGBA8，R在最低字节
+    float log2_size = 0;
+};
+
+// 贴图缓存的统计
+struct TextureCacheStats {
+    uint32_t requests = 0;      // get的调用次数
+    uint32_t loads = 0;         // 实际解码文件的次数
+    uint32_t resident = 0;      // 缓存中的贴图数
+    size_t resident_bytes = 0;  // 缓存中的贴图占用的字节数
+};
+
+//---------------------------
+// 进程内的贴图缓存，按路径共享已解码的贴图，同一个文件只解码一次。
+// 缓存持有贴图直到clear_unused，期间重新建立场景也不会重复解码
+class TextureCache {
+public:
+    static TextureCache &instance();
+
+    // 返回path对应的贴图，不在缓存中时加载，可以在多个线程中调用
+    std::shared_ptr<const Texture> get(const std::string &path);
+    // 释放没有材质引用的贴图
+    void clear_unused();
+    TextureCacheStats get_stats();
+
+private:
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<const Texture>> textures;
+    uint32_t requests = 0, loads = 0;
+};
@@ -0,0 +1,66 @@
+#include "TileScheduler.h"
+#include "glmath.h"
+
+#include <algorithm>
+
+// 交错x和y的二进制位得到Morton码
+static uint32_t morton_code(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffff;
+        v = (v | (v << 8)) & 0x00ff00ff;
+        v = (v | (v << 4)) & 0x0f0f0f0f;
+        v = (v | (v << 2)) & 0x33333333;
+        v = (v | (v << 1)) & 0x55555555;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1);
+}
+
+void TileScheduler::make_tiles(uint32_t width, uint32_t height) {
+    const uint32_t nx = (width + tile_size - 1) / tile_size;
+    const uint32_t ny = (height + tile_size - 1) / tile_size;
+
+    struct Key {
+        uint32_t tx, ty;
+        uint64_t key;
+    };
+    std::vector<Key> keys;
+    keys.reserve(nx * ny);
+    for (uint32_t ty = 0; ty < ny; ty++) {
+        for (uint32_t tx = 0; tx < nx; tx++) {
+            uint64_t key;
+            if (order == TILE_ORDER_MORTON) {
+                key = morton_code(tx, ty);
+            } else if (order == TILE_ORDER_SPIRAL) {
+                // 先按到中心的方形环排序，同一环上按角度排序（坐标乘2，避免中心落在半格上）
+                int dx = 2 * (int)tx - (int)(nx - 1), dy = 2 * (int)ty - (int)(ny - 1);
+                uint32_t ring = (uint32_t)std::max(abs(dx), abs(dy));
+                float angle = (atan2f((float)dy, (float)dx) + (float)M_PI) / (2.0f * (float)M_PI);
+                key = ((uint64_t)ring << 32) | (uint32_t)(angle * 2147483647.0f);
+            } else {
+                key = (uint64_t)ty * nx + tx;
+            }
+            keys.push_back({tx, ty, key});
+        }
+    }
+    std::stable_sort(keys.begin(), keys.end(), [](const Key &a, const Key &b) { return a.key < b.key; });
+
+    tiles.clear();
+    for (const auto &k : keys) {
+        Tile tile;
+        tile.x0 = k.tx * tile_size;
+        tile.y0 = k.ty * tile_size;
+        tile.x1 = std::min(tile.x0 + tile_size, width);
+        tile.y1 = std::min(tile.y0 + tile_size, height);
+        tiles.push_back(tile);
+    }
+}
+
+void TileScheduler::distribute(uint32_t worker_count) {
+    if (queues.size() != worker_count)
+        queues = std::vector<WorkQueue>(worker_count);
+    // 按顺序连续地分给每个线程，保持同一线程渲染的块在空间上相邻
+    const uint32_t n = (uint32_t)tiles.size();
+    for (uint32_t w = 0; w < worker_count; w++)
+        queues[w].range = pack(n * w / worker_count, n * (w + 1) / worker_count);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "SThreadPool.h"
+#include "clock.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+// 块的遍历顺序
+enum TileOrder {
+    TILE_ORDER_SCANLINE, // 逐行
+    TILE_ORDER_MORTON,   // Z曲线，相邻的块在空间上也相邻
+    TILE_ORDER_SPIRAL    // 从画面中心向外螺旋，先渲染中心
+};
+
+// 屏幕上的一个矩形块，[x0, x1) x [y0, y1)
+struct Tile {
+    uint32_t x0, y0, x1, y1;
+};
+
+// 每个工作线程一帧内的统计
+struct WorkerStats {
+    float busy_ms = 0; // 渲染块的时间
+    float idle_ms = 0; // 帧内没有工作的时间
+    uint32_t tiles = 0;  // 完成的块数
+    uint32_t stolen = 0; // 其中从其他线程偷来的块数
+};
+
+//---------------------------
+// 分块渲染调度：按给定顺序排好的块平均分给每个工作线程，
+// 线程从自己队列的头部取块，自己的做完了就从其他线程队列的尾部偷块
+class TileScheduler {
+public:
+    void set_tile_size(uint32_t size) { tile_size = size > 0 ? size : 1; }
+    uint32_t get_tile_size() const { return tile_size; }
+    void set_order(TileOrder o) { order = o; }
+    TileOrder get_order() const { return order; }
+
+    // 把width x height的画面分块，线程池的每个线程运行一个工作者，对每个块调用fn(tile)，返回时所有块都已完成
+    template <typename Fn> void run(SThreadPool::ThreadPool &pool, uint32_t width, uint32_t height, Fn &&fn) {
+        make_tiles(width, height);
+        const uint32_t worker_count = (uint32_t)pool.thread_count();
+        distribute(worker_count);
+        stats.assign(worker_count, WorkerStats());
+
+        Clock frame_clock;
+        SThreadPool::TaskGroup group(pool);
+        for (uint32_t w = 0; w < worker_count; w++) {
+            group.run([this, w, &fn] {
+                WorkerStats &worker = stats[w];
+                uint32_t index;
+                bool stolen;
+                while (next_tile(w, index, stolen)) {
+                    Clock clock;
+                    fn(tiles[index]);
+                    worker.busy_ms += clock.get_current_delta();
+                    worker.tiles++;
+                    worker.stolen += stolen;
+                }
+            });
+        }
+        group.wait();
+
+        frame_ms = frame_clock.get_current_delta();
+        for (auto &worker : stats)
+            worker.idle_ms = std::max(frame_ms - worker.busy_ms, 0.0f);
+    }
+
+    const std::vector<WorkerStats> &get_stats() const { return stats; }
+    float get_frame_ms() const { return frame_ms; }
+
+private:
+    // 每个工作线程的块队列，是tiles中的一段[head, tail)，两个下标打包在一个64位原子变量中，
+    // 自己从head取，其他线程从tail偷，都用CAS修改
+    struct alignas(64) WorkQueue {
+        std::atomic<uint64_t> range{0};
+    };
+
+    static uint64_t pack(uint32_t head, uint32_t tail) { return ((uint64_t)tail << 32) | head; }
+
+    bool pop_front(WorkQueue &queue, uint32_t &index) {
+        uint64_t range = queue.range.load();
+        while (true) {
+            uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+            if (head >= tail)
+                return false;
+            if (queue.range.compare_exchange_weak(range, pack(head + 1, tail))) {
+                index = head;
+                return true;
+            }
+        }
+    }
+
+    bool pop_back(WorkQueue &queue, uint32_t &index) {
+        uint64_t range = queue.range.load();
+        while (true) {
+            uint32_t head = (uint32_t)range, tail = (uint32_t)(range >> 32);
+            if (head >= tail)
+                return false;
+            if (queue.range.compare_exchange_weak(range, pack(head, tail - 1))) {
+                index = tail - 1;
+                return true;
+            }
+        }
+    }
+
+    bool next_tile(uint32_t worker, uint32_t &index, bool &stolen) {
+        stolen = false;
+        if (pop_front(queues[worker], index))
+            return true;
+        stolen = true;
+        for (uint32_t i = 1; i < queues.size(); i++)
+            if (pop_back(queues[(worker + i) % queues.size()], index))
+                return true;
+        return false;
+    }
+
+    void make_tiles(uint32_t width, uint32_t height);
+    void distribute(uint32_t worker_count);
+
+    uint32_t tile_size = 16;
+    TileOrder order = TILE_ORDER_MORTON;
+    std::vector<Tile> tiles;
+    std::vector<WorkQueue> queues;
+    std::vector<WorkerStats> stats;
+    float frame_ms = 0;
+};
@@ -1,7 +1,6 @@
 #pragma once
 
 #define _USE_MATH_DEFINES // M_PI
-#include <array>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,6 +57,7 @@ struct vec3 {
     vec3 operator*(const vec3 &v) const { return vec3(x * v.x, y * v.y, z * v.z); }
     vec3 operator-() const { return vec3(-x, -y, -z); }
     float &operator[](size_t index) { return ((float *)this)[index]; }
+    float operator[](size_t index) const { return ((const float *)this)[index]; }
     vec3 operator/(const vec3 denom) const { return vec3(this->x / denom.x, this->y / denom.y, this->z / denom.z); }
 
     bool operator==(const vec3 &n2) const{
@@ -137,6 +137,55 @@ inline mat4 RotationMatrix(float angle, vec3 w) {
                 0, 1);
 }
 
+// 矩阵按行向量约定作用于点和向量：p' = p * M，平移在第3行，与TranslateMatrix等一致。
+// mat4 * vec3不做变换，需要变换时使用下面的函数
+inline vec3 transform_point(const vec3 &p, const mat4 &M) {
+    return vec3(p.x * M.m[0][0] + p.y * M.m[1][0] + p.z * M.m[2][0] + M.m[3][0],
+                p.x * M.m[0][1] + p.y * M.m[1][1] + p.z * M.m[2][1] + M.m[3][1],
+                p.x * M.m[0][2] + p.y * M.m[1][2] + p.z * M.m[2][2] + M.m[3][2]);
+}
+
+inline vec3 transform_vector(const vec3 &v, const mat4 &M) {
+    return vec3(v.x * M.m[0][0] + v.y * M.m[1][0] + v.z * M.m[2][0], v.x * M.m[0][1] + v.y * M.m[1][1] + v.z * M.m[2][1],
+                v.x * M.m[0][2] + v.y * M.m[1][2] + v.z * M.m[2][2]);
+}
+
+// 法线按逆矩阵的转置变换，inverse为M的逆矩阵，结果没有归一化
+inline vec3 transform_normal(const vec3 &n, const mat4 &inverse) {
+    return vec3(n.x * inverse.m[0][0] + n.y * inverse.m[0][1] + n.z * inverse.m[0][2],
+                n.x * inverse.m[1][0] + n.y * inverse.m[1][1] + n.z * inverse.m[1][2],
+                n.x * inverse.m[2][0] + n.y * inverse.m[2][1] + n.z * inverse.m[2][2]);
+}
+
+// 左上角3x3部分的行列式
+inline float determinant3(const mat4 &M) {
+    return M.m[0][0] * (M.m[1][1] * M.m[2][2] - M.m[1][2] * M.m[2][1]) -
+           M.m[0][1] * (M.m[1][0] * M.m[2][2] - M.m[1][2] * M.m[2][0]) +
+           M.m[0][2] * (M.m[1][0] * M.m[2][1] - M.m[1][1] * M.m[2][0]);
+}
+
+// 仿射变换（最后一列为(0, 0, 0, 1)）的逆：p' = p * A + t，则p = (p' - t) * A^-1
+inline mat4 inverse_affine(const mat4 &M) {
+    float inv_det = 1.0f / determinant3(M);
+    mat4 R;
+    R.m[0][0] = (M.m[1][1] * M.m[2][2] - M.m[1][2] * M.m[2][1]) * inv_det;
+    R.m[0][1] = (M.m[0][2] * M.m[2][1] - M.m[0][1] * M.m[2][2]) * inv_det;
+    R.m[0][2] = (M.m[0][1] * M.m[1][2] - M.m[0][2] * M.m[1][1]) * inv_det;
+    R.m[1][0] = (M.m[1][2] * M.m[2][0] - M.m[1][0] * M.m[2][2]) * inv_det;
+    R.m[1][1] = (M.m[0][0] * M.m[2][2] - M.m[0][2] * M.m[2][0]) * inv_det;
+    R.m[1][2] = (M.m[0][2] * M.m[1][0] - M.m[0][0] * M.m[1][2]) * inv_det;
+    R.m[2][0] = (M.m[1][0] * M.m[2][1] - M.m[1][1] * M.m[2][0]) * inv_det;
+    R.m[2][1] = (M.m[0][1] * M.m[2][0] - M.m[0][0] * M.m[2][1]) * inv_det;
+    R.m[2][2] = (M.m[0][0] * M.m[1][1] - M.m[0][1] * M.m[1][0]) * inv_det;
+    vec3 t = -transform_vector(vec3(M.m[3][0], M.m[3][1], M.m[3][2]), R);
+    R.m[0][3] = R.m[1][3] = R.m[2][3] = 0;
+    R.m[3][0] = t.x;
+    R.m[3][1] = t.y;
+    R.m[3][2] = t.z;
+    R.m[3][3] = 1;
+    return R;
+}
+
 //--------------------------
 struct vec4 {
     //--------------------------
@@ -170,42 +219,3 @@ struct vec4 {
 inline float dot(const vec4 &v1, const vec4 &v2) { return (v1.x * v2.x + v1.y * v2.y + v1.z * v2.z + v1.w * v2.w); }
 
 inline vec4 operator*(float a, const vec4 &v) { return vec4(v.x * a, v.y * a, v.z * a, v.w * a); }
-
-inline vec2 solve_uv_guass(vec3 x, vec3 y, vec3 z, vec3 p) {
-    vec2 uv = vec2(0.0, 0.0);
-
-    p = p - z;
-    x = x - z;
-    y = y - z;
-
-    std::array<vec3, 3> l{
-        vec3(x[0], y[0], p[0]),
-        vec3(x[1], y[1], p[1]),
-        vec3(x[2], y[2], p[2]),
-    };
-
-    vec3 v(fabs(x[0]), fabs(x[1]), fabs(x[2]));
-    auto m_i = [&] {
-        if (v[0] > v[1]) {
-            if (v[0] > v[2]) {
-                return 0;
-            } else {
-                return 2;
-            }
-        } else if (v[1] > v[2]) {
-            return 1;
-        } else {
-            return 2;
-        }
-    }();
-    std::swap(l[0], l[m_i]);
-
-    l[1] = l[1] + l[0] * (-l[1][0] / l[0][0]);
-    l[2] = l[2] + l[0] * (-l[2][0] / l[0][0]);
-
-    uv[1] = fabs(l[1][1]) > fabs(l[2][1]) ? l[1][2] / l[1][1] : l[2][2] / l[2][1];
-
-    uv[0] = (l[0][2] - l[0][1] * uv[1]) / l[0][0];
-
-    return uv;
-}
@@ -1,73 +1,597 @@
+#include "AccelCache.h"
+#include "GltfLoader.h"
 #include "SThreadPool.h"
+#include "clock.h"
 #include "scene.h"
 
+#include <string.h>
+
 static SThreadPool::ThreadPool pool;
 
 Scene scene;
+thread_local uint64_t thread_ray_count = 0;
+
+// 栈中等待追踪的光线，weight为它带回的颜色对像素的贡献系数
+struct TraceEntry {
+    Ray ray;
+    vec3 weight;
+    uint32_t depth;
+    float distance; // 从视点到光线起点的路径长度，用于估计贴图的footprint
+};
+
+// 当前线程的追踪统计和轮盘赌用的随机数状态
+static thread_local TraceStats thread_trace_stats;
+static thread_local uint32_t thread_roulette_state = 1;
+
+// 当前线程每个光源上一次的遮挡物，相邻像素的阴影光线通常被同一个图元遮挡
+struct OccluderCache {
+    uint64_t generation = 0;
+    vector<uint32_t> refs; // 没有时为UINT32_MAX
+};
+static thread_local OccluderCache thread_occluder_cache;
+
+uint64_t Scene::new_occluder_generation() {
+    static std::atomic<uint64_t> next{1};
+    return next++;
+}
+
+// 整数哈希，用于轮盘赌和抽取光源的随机数
+static uint32_t hash_uint(uint32_t v) {
+    v ^= v >> 16;
+    v *= 0x7feb352d;
+    v ^= v >> 15;
+    v *= 0x846ca68b;
+    v ^= v >> 16;
+    return v;
+}
 
 void Scene::render(vector<vec4> &image) {
     //std::cout << "Start Rendering" << std::endl;
-    long timeStart = glutGet(GLUT_ELAPSED_TIME);
-    // 对视窗的每一个像素做渲染
-    for (uint32_t Y = 0; Y < windowHeight; Y++) {
-        pool.add_task([this, &image, Y] {
-            for (uint32_t X = 0; X < windowWidth; X++) {
-                // 追踪这条光线，获得返回的颜色
-                vec3 color = trace(viewPoint.getRay(X, Y));
-                image[Y * windowWidth + X] = vec4(color.x, color.y, color.z, 1);
+    // 上一帧之后移动过的图元先更新到BVH中
+    refit_bvh();
+    Clock clock;
+    frame_ray_count = 0;
+    for (uint32_t d = 0; d <= max_trace_depth + 1; d++)
+        frame_traced[d] = frame_culled[d] = 0;
+    image.resize((size_t)width * height);
+    // 视点或分辨率变化后重新开始累积
+    if (progressive && (spp == 0 || accumulated_view != viewPoint.get_revision() ||
+                        accumulation.size() != image.size())) {
+        accumulation.assign(image.size(), vec3(0, 0, 0));
+        accumulated_view = viewPoint.get_revision();
+        spp = 0;
+    }
+    // 已累积到目标样本数，image中保留的就是最终结果
+    if (progressive && target_spp > 0 && spp >= target_spp) {
+        frame_ms = clock.get_current_delta();
+        return;
+    }
+    // 分块渲染视窗的每一个像素，块由各线程互相偷取，避免帧末尾部分线程空闲
+    scheduler.run(pool, width, height, [this, &image](const Tile &tile) {
+        uint64_t rays_before = thread_ray_count;
+        TraceStats stats_before = thread_trace_stats;
+        if (packet_tracing) {
+            for (uint32_t Y = tile.y0; Y < tile.y1; Y += PACKET_HEIGHT)
+                for (uint32_t X = tile.x0; X < tile.x1; X += PACKET_WIDTH)
+                    trace_packet(X, Y, tile, image);
+        } else {
+            for (uint32_t Y = tile.y0; Y < tile.y1; Y++) {
+                for (uint32_t X = tile.x0; X < tile.x1; X++) {
+                    // 追踪这条光线，获得返回的颜色
+                    Ray ray = primary_ray(X, Y);
+                    vec3 color = radiance(ray, firstIntersect(ray), X, Y);
+                    store_pixel(image, X, Y, color);
+                }
             }
-        });
-        // for (int X = 0; X < windowWidth; X++)
-        // {
-        // 	// 追踪这条光线，获得返回的颜色
-        // 	vec3 color = trace(viewPoint.getRay(X, Y));
-        // 	image[Y * windowWidth + X] = vec4(color.x, color.y, color.z, 1);
-        // }
+        }
+        frame_ray_count += thread_ray_count - rays_before;
+        for (uint32_t d = 0; d <= max_trace_depth + 1; d++) {
+            frame_traced[d] += thread_trace_stats.traced[d] - stats_before.traced[d];
+            frame_culled[d] += thread_trace_stats.culled[d] - stats_before.culled[d];
+        }
+    });
+    if (progressive)
+        spp++;
+
+    frame_ms = clock.get_current_delta();
+    if (!print_stats)
+        return;
+    float seconds = std::max(frame_ms, 1.0f) * 0.001f;
+    cout << (packet_tracing ? "[packet] " : "[scalar] ") << (integrator == INTEGRATOR_PATH ? "[path] " : "")
+         << "FPS:" << 1.0 / seconds << ", MRays/s:" << frame_ray_count / seconds * 1e-6 << ", " << width << "x" << height;
+    if (progressive)
+        cout << ", spp:" << spp;
+    cout << endl;
+    // 每个深度追踪/剔除的光线数
+    cout << "  traced/culled by depth:";
+    for (uint32_t d = 0; d <= max_trace_depth + 1; d++)
+        cout << " " << d << ":" << frame_traced[d] << "/" << frame_culled[d];
+    cout << endl;
+    // 每个线程的忙碌/空闲时间
+    const auto &stats = scheduler.get_stats();
+    for (size_t i = 0; i < stats.size(); i++) {
+        cout << "  worker " << i << ": busy " << stats[i].busy_ms << "ms, idle " << stats[i].idle_ms << "ms, "
+             << stats[i].tiles << " tiles (" << stats[i].stolen << " stolen)" << endl;
+    }
+}
+
+void Scene::trace_packet(uint32_t X, uint32_t Y, const Tile &tile, vector<vec4> &image) {
+    Ray rays[PACKET_SIZE];
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        // 超出块的光线取边界上的像素，结果不写入
+        uint32_t x = std::min(X + i % PACKET_WIDTH, tile.x1 - 1);
+        uint32_t y = std::min(Y + i / PACKET_WIDTH, tile.y1 - 1);
+        rays[i] = primary_ray(x, y);
+    }
+    Hit hits[PACKET_SIZE];
+    firstIntersect(rays, hits);
+    for (int i = 0; i < PACKET_SIZE; i++) {
+        uint32_t x = X + i % PACKET_WIDTH, y = Y + i / PACKET_WIDTH;
+        if (x >= tile.x1 || y >= tile.y1)
+            continue;
+        vec3 color = radiance(rays[i], hits[i], x, y);
+        store_pixel(image, x, y, color);
     }
-    pool.wait_for_all_done();
+}
 
-    cout << "FPS:" << 1.0 / ((glutGet(GLUT_ELAPSED_TIME) - timeStart) * 0.001f) << endl;
+Ray Scene::primary_ray(uint32_t X, uint32_t Y) {
+    // Whitted光线追踪的第一个样本取像素中心，与非渐进模式的画面相同
+    if (integrator == INTEGRATOR_WHITTED && (!progressive || spp == 0))
+        return viewPoint.getRay(X, Y);
+    return viewPoint.getRay(X, Y, sampler.get(X, Y, spp, 0), sampler.get(X, Y, spp, 1));
 }
 
-vec3 Scene::trace(Ray ray, int depth) {
-    // 设置迭代终止条件
-    if (depth > 5) // 设置迭代上限5次
-        return La;
-    Hit hit = firstIntersect(ray);
+void Scene::store_pixel(vector<vec4> &image, uint32_t X, uint32_t Y, vec3 color) {
+    size_t index = (size_t)Y * width + X;
+    if (progressive) {
+        accumulation[index] += color;
+        color = accumulation[index] / (float)(spp + 1);
+    }
+    image[index] = vec4(color.x, color.y, color.z, 1);
+}
 
-    if (hit.s < 0) // 不再有交，则返回环境光即可
-        return La;
+vec3 Scene::trace(const Ray &primary, const Hit &primary_hit) {
+    TraceStats &stats = thread_trace_stats;
+    TraceEntry stack[trace_stack_size];
+    uint32_t top = 0;
+    vec3 color(0, 0, 0);
+    const float pixel_angle = viewPoint.pixel_angle();
 
-    // 针对粗糙材质，使用phong模型计算漫反射
-    if (hit.material->type == ROUGH || hit.material->type == ROUGH_TEXTURE) {
-        return phong_shading(-ray.dir, hit);
+    // 分支入栈前决定是否剔除，剔除的分支用环境光近似（与超过最大深度时相同），轮盘赌终止的分支贡献为0
+    auto push = [&](const Ray &ray, vec3 weight, uint32_t depth, float distance) {
+        float max_weight = std::max(weight.x, std::max(weight.y, weight.z));
+        if (depth > max_trace_depth || max_weight < fresnel_cutoff || top == trace_stack_size) {
+            stats.culled[depth]++;
+            color += La * weight;
+            return;
+        }
+        if (russian_roulette && depth >= roulette_depth) {
+            float survive = std::min(max_weight, 1.0f);
+            thread_roulette_state = hash_uint(thread_roulette_state + 0x9e3779b9);
+            if ((thread_roulette_state >> 8) * (1.0f / 16777216.0f) >= survive) {
+                stats.culled[depth]++;
+                return;
+            }
+            weight = weight / survive;
+        }
+        stack[top++] = {ray, weight, depth, distance};
+    };
+
+    TraceEntry entry = {primary, vec3(1, 1, 1), 0, 0};
+    Hit hit = primary_hit;
+    while (true) {
+        stats.traced[entry.depth]++;
+        const Ray &ray = entry.ray;
+        if (hit.s < 0) {
+            // 不再有交，则返回环境光即可
+            color += La * entry.weight;
+        } else {
+            const Material &material = materials[hit.material];
+            if (material.type == ROUGH || material.type == ROUGH_TEXTURE) {
+                // 针对粗糙材质，使用phong模型计算漫反射
+                color += phong_shading(-ray.dir, hit, pixel_angle * (entry.distance + hit.s)) * entry.weight;
+            } else {
+                // 镜面反射（继续追踪）
+                float cosa = -dot(ray.dir, hit.normal);
+                vec3 one(1, 1, 1);
+                vec3 F = material.F0 + (one - material.F0) * pow(1 - cosa, 5);
+                vec3 reflectedDir = ray.dir - hit.normal * dot(hit.normal, ray.dir) * 2.0f; // 反射光线R = v + 2Ncosa
+                float distance = entry.distance + hit.s;
+                push(Ray(hit.position + hit.normal * epsilon, reflectedDir), entry.weight * F, entry.depth + 1, distance);
+
+                // 对于透明物体，计算折射（继续追踪）
+                if (material.type == REFRACTIVE) {
+                    float disc = 1 - (1 - cosa * cosa) / material.ior / material.ior;
+                    if (disc >= 0) {
+                        vec3 refractedDir = ray.dir / material.ior + hit.normal * (cosa / material.ior - sqrt(disc));
+                        push(Ray(hit.position - hit.normal * epsilon, refractedDir), entry.weight * (one - F),
+                             entry.depth + 1, distance);
+                    }
+                }
+            }
+        }
+
+        if (top == 0)
+            break;
+        entry = stack[--top];
+        hit = firstIntersect(entry.ray);
     }
+    return color;
+}
+
+// 以n为z轴的正交基（Duff et al. 2017），n为单位向量
+static void make_frame(vec3 n, vec3 &t, vec3 &b) {
+    float sign = copysignf(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float c = n.x * n.y * a;
+    t = vec3(1.0f + sign * n.x * n.x * a, sign * c, -sign * n.x);
+    b = vec3(c, sign + n.y * n.y * a, -n.y);
+}
+
+// 在以axis为轴、与轴夹角余弦为cos_theta的圆锥面上按phi取方向
+static vec3 direction_around(vec3 axis, float cos_theta, float phi) {
+    vec3 t, b;
+    make_frame(axis, t, b);
+    float sin_theta = sqrtf(std::max(0.0f, 1.0f - cos_theta * cos_theta));
+    return t * (sin_theta * cosf(phi)) + b * (sin_theta * sinf(phi)) + axis * cos_theta;
+}
+
+// 多重重要性采样的幂启发式权重（beta = 2）
+static float power_heuristic(float pdf, float other_pdf) {
+    float a = pdf * pdf, b = other_pdf * other_pdf;
+    return a + b > 0 ? a / (a + b) : 0;
+}
 
-    // 镜面反射（继续追踪）
-    float cosa = -dot(ray.dir, hit.normal);
-    vec3 one(1, 1, 1);
-    vec3 F = hit.material->F0 + (one - hit.material->F0) * pow(1 - cosa, 5);
-    vec3 reflectedDir = ray.dir - hit.normal * dot(hit.normal, ray.dir) * 2.0f; // 反射光线R = v + 2Ncosa
+static float max_component(vec3 v) { return std::max(v.x, std::max(v.y, v.z)); }
 
-    // 递归调用trace()
-    vec3 outRadiance = trace(Ray(hit.position + hit.normal * epsilon, reflectedDir), depth + 1) * F;
+// 路径追踪中每个样本的前两维用于像素内抖动，之后每次弹射占用固定的维数
+static const uint32_t path_pixel_dimensions = 2;
+static const uint32_t path_bounce_dimensions = 6;
 
-    // 对于透明物体，计算折射（继续追踪）
-    if (hit.material->type == REFRACTIVE) {
-        float disc = 1 - (1 - cosa * cosa) / hit.material->ior / hit.material->ior;
-        if (disc >= 0) {
-            vec3 refractedDir = ray.dir / hit.material->ior + hit.normal * (cosa / hit.material->ior - sqrt(disc));
-            // 递归调用trace()
-            outRadiance += trace(Ray(hit.position - hit.normal * epsilon, refractedDir), depth + 1) * (one - F);
+// 环境光直接采样时在法线半球上均匀取方向的概率密度
+static const float environment_pdf = 1.0f / (2.0f * (float)M_PI);
+
+//---------------------------
+// 路径追踪中粗糙材质的BSDF：Lambert漫反射加归一化的Phong光泽反射。
+// kd + ks超过1时两者按比例缩小，保证能量守恒；采样时按两者的大小选择分量
+struct PathBSDF {
+    vec3 kd, ks;
+    float shininess;
+    float specular_probability;
+
+    PathBSDF(vec3 _kd, const Material &material) : kd(_kd), ks(material.ks), shininess(material.shininess) {
+        float total = max_component(kd + ks);
+        if (total > 1) {
+            kd = kd / total;
+            ks = ks / total;
         }
+        float d = max_component(kd), s = max_component(ks);
+        specular_probability = d + s > 0 ? s / (d + s) : 0;
+    }
+
+    static vec3 reflect(vec3 V, vec3 N) { return N * (2.0f * dot(N, V)) - V; }
+
+    // V为指向观察者的方向，L为指向光源的方向，都在法线N一侧
+    vec3 eval(vec3 V, vec3 L, vec3 N) const {
+        vec3 f = kd * (1.0f / (float)M_PI);
+        float cos_alpha = dot(reflect(V, N), L);
+        if (cos_alpha > 0)
+            f += ks * ((shininess + 2) / (2 * (float)M_PI) * powf(cos_alpha, shininess));
+        return f;
     }
 
-    return outRadiance;
+    float pdf(vec3 V, vec3 L, vec3 N) const {
+        float diffuse = std::max(dot(N, L), 0.0f) / (float)M_PI;
+        float cos_alpha = dot(reflect(V, N), L);
+        float specular = cos_alpha > 0 ? (shininess + 1) / (2 * (float)M_PI) * powf(cos_alpha, shininess) : 0;
+        return (1 - specular_probability) * diffuse + specular_probability * specular;
+    }
+
+    // 按pdf采样入射方向，落在表面下方时返回false
+    bool sample(vec3 V, vec3 N, SampleStream &samples, vec3 &L) const {
+        float lobe = samples.next(), u = samples.next(), v = samples.next();
+        float phi = 2 * (float)M_PI * v;
+        if (lobe < specular_probability)
+            L = direction_around(reflect(V, N), powf(u, 1 / (shininess + 1)), phi);
+        else
+            L = direction_around(N, sqrtf(u), phi); // 余弦加权
+        return dot(N, L) > 0;
+    }
+};
+
+vec3 Scene::radiance(const Ray &ray, const Hit &hit, uint32_t X, uint32_t Y) {
+    if (integrator == INTEGRATOR_WHITTED)
+        return trace(ray, hit);
+    // 第spp个样本，前两维已用于像素内抖动。同一帧同一像素的路径总是相同的
+    SampleStream samples(sampler, X, Y, spp, path_pixel_dimensions);
+    return trace_path(ray, hit, samples);
 }
 
-void Scene::add_cquad(vec3 a, vec3 b, vec3 c, vec3 d, Material mat){
-    objects.emplace_back(new Triange(a, b, c, mat));
-    objects.emplace_back(new Triange(c, d, a, mat));
+vec3 Scene::trace_path(const Ray &primary, const Hit &primary_hit, SampleStream &samples) {
+    TraceStats &stats = thread_trace_stats;
+    const float pixel_angle = viewPoint.pixel_angle();
+    const uint32_t environment_light = (uint32_t)(direction_lights.size() + point_lights.size());
+    vec3 color(0, 0, 0);
+    vec3 throughput(1, 1, 1);
+    Ray ray = primary;
+    Hit hit = primary_hit;
+    float distance = 0;
+    // 当前光线由BSDF采样得到时的概率密度；主光线和镜面反射/折射为0，逃逸时不与环境光采样做MIS
+    float bsdf_pdf = 0;
+
+    for (uint32_t depth = 0;; depth++) {
+        stats.traced[depth]++;
+        // 每次弹射使用固定的几维：环境光采样2维，BSDF采样或镜面分支选择3维，轮盘赌1维
+        const uint32_t bounce_dimension = path_pixel_dimensions + depth * path_bounce_dimensions;
+        samples.dimension = bounce_dimension;
+        if (hit.s < 0) {
+            float weight = bsdf_pdf > 0 ? power_heuristic(bsdf_pdf, environment_pdf) : 1.0f;
+            color += La * throughput * weight;
+            break;
+        }
+        const Material &material = materials[hit.material];
+        const vec3 N = hit.normal, V = -ray.dir;
+        distance += hit.s;
+
+        vec3 next_dir;
+        if (material.type == ROUGH || material.type == ROUGH_TEXTURE) {
+            PathBSDF bsdf(diffuse_color(V, hit, pixel_angle * distance), material);
+            Ray shadow_ray(hit.position + N * epsilon, N);
+
+            // 方向光和点光源是delta分布，BSDF采样不可能击中，只做直接采样
+            for (uint32_t i = 0; i < direction_lights.size(); i++) {
+                const auto &light = direction_lights[i];
+                vec3 L = normalize(light.direction);
+                float cos_theta = dot(N, L);
+                shadow_ray.dir = L;
+                if (cos_theta > 0 && !shadowIntersect(shadow_ray, FLT_MAX, i))
+                    color += throughput * light.Le * bsdf.eval(V, L, N) * cos_theta;
+            }
+            for_each_point_light(hit.position, N, [&](uint32_t i, float weight) {
+                const auto &light = point_lights[i];
+                vec3 to_light = light.position - hit.position;
+                float light_distance = length(to_light);
+                vec3 L = to_light / light_distance;
+                float cos_theta = dot(N, L);
+                shadow_ray.dir = L;
+                if (cos_theta > 0 &&
+                    !shadowIntersect(shadow_ray, light_distance, (uint32_t)direction_lights.size() + i))
+                    color += throughput * light.Le * bsdf.eval(V, L, N) *
+                             (cos_theta * weight / (light_distance * light_distance));
+            });
+            // 环境光：在半球上均匀采样，与BSDF采样逃逸的光线按幂启发式分配权重
+            if (max_component(La) > 0) {
+                float u = samples.next(), v = samples.next();
+                vec3 L = direction_around(N, u, 2 * (float)M_PI * v);
+                shadow_ray.dir = L;
+                if (!shadowIntersect(shadow_ray, FLT_MAX, environment_light)) {
+                    float weight = power_heuristic(environment_pdf, bsdf.pdf(V, L, N));
+                    color += throughput * La * bsdf.eval(V, L, N) * (dot(N, L) / environment_pdf * weight);
+                }
+            }
+
+            // 按BSDF采样下一段路径
+            samples.dimension = bounce_dimension + 2;
+            if (!bsdf.sample(V, N, samples, next_dir))
+                break;
+            bsdf_pdf = bsdf.pdf(V, next_dir, N);
+            if (bsdf_pdf <= 0)
+                break;
+            throughput = throughput * bsdf.eval(V, next_dir, N) * (dot(N, next_dir) / bsdf_pdf);
+        } else {
+            // 镜面反射和折射：按Fresnel项随机选择其中一支
+            float cosa = -dot(ray.dir, N);
+            vec3 one(1, 1, 1);
+            vec3 F = material.F0 + (one - material.F0) * pow(1 - cosa, 5);
+            vec3 reflected = ray.dir - N * dot(N, ray.dir) * 2.0f;
+            float disc = 1 - (1 - cosa * cosa) / material.ior / material.ior;
+            samples.dimension = bounce_dimension + 2;
+            if (material.type == REFRACTIVE && disc >= 0) {
+                float reflect_probability = (F.x + F.y + F.z) / 3;
+                if (samples.next() < reflect_probability) {
+                    next_dir = reflected;
+                    throughput = throughput * F / reflect_probability;
+                } else {
+                    next_dir = ray.dir / material.ior + N * (cosa / material.ior - sqrt(disc));
+                    throughput = throughput * (one - F) / (1 - reflect_probability);
+                }
+            } else {
+                next_dir = reflected;
+                throughput = throughput * F;
+            }
+            bsdf_pdf = 0;
+        }
+
+        // 超过最大深度或被轮盘赌终止的路径贡献为0，轮盘赌使每个样本的平均代价有界
+        if (depth + 1 > max_trace_depth) {
+            stats.culled[depth + 1]++;
+            break;
+        }
+        if (depth + 1 >= roulette_depth) {
+            float survive = std::min(max_component(throughput), 0.95f);
+            samples.dimension = bounce_dimension + 5;
+            if (samples.next() >= survive) {
+                stats.culled[depth + 1]++;
+                break;
+            }
+            throughput = throughput / survive;
+        }
+        // 折射光线从表面另一侧出发
+        bool inside = dot(next_dir, N) < 0;
+        ray = Ray(hit.position + N * (inside ? -epsilon : epsilon), next_dir);
+        hit = firstIntersect(ray);
+    }
+    return color;
+}
+
+bool Scene::shadowIntersect(const Ray &ray, float max_distance, uint32_t light) {
+    thread_ray_count++;
+    OccluderCache &cache = thread_occluder_cache;
+    if (cache.generation != occluder_generation) {
+        cache.refs.assign(direction_lights.size() + point_lights.size() + 1, UINT32_MAX);
+        cache.generation = occluder_generation;
+    }
+    // 光源编号超出缓存范围时不用缓存
+    uint32_t uncached = UINT32_MAX;
+    uint32_t &last = light < cache.refs.size() ? cache.refs[light] : uncached;
+    if (last != UINT32_MAX && prims.occludes(last, ray, max_distance))
+        return true;
+
+    for (uint32_t i = 0; i < prims.planes.size(); i++) {
+        if (prims.planes[i].occludes(ray, max_distance)) {
+            last = make_primitive_ref(PRIM_PLANE, i);
+            return true;
+        }
+    }
+    return bvh.any(ray, max_distance, [&](uint32_t id) {
+        if (!prims.occludes(id, ray, max_distance))
+            return false;
+        last = id;
+        return true;
+    });
+}
+
+TraceStats Scene::get_trace_stats() const {
+    TraceStats stats;
+    for (uint32_t d = 0; d <= max_trace_depth + 1; d++) {
+        stats.traced[d] = frame_traced[d];
+        stats.culled[d] = frame_culled[d];
+    }
+    return stats;
+}
+
+void Scene::add_cquad(vec3 a, vec3 b, vec3 c, vec3 d, uint32_t mat){
+    prims.triangles.emplace_back(a, b, c, mat);
+    prims.triangles.emplace_back(c, d, a, mat);
+}
+
+void Scene::load_gltf(const std::string &path, uint32_t material, const mat4 &transform) {
+    Clock clock;
+    GltfScene gltf;
+    // 缓存放在模型旁边，键包含材质，因为三角形中保存了材质下标
+    std::string cache_path = path + ".rtcache";
+    uint64_t key = 0;
+    bool cached = false;
+    if (accel_cache) {
+        key = AccelCache::make_key(gltf_files(path), material);
+        cached = AccelCache::read(cache_path, key, gltf.meshes, gltf.instances);
+    }
+    float load_ms = clock.get_current_delta();
+    if (!cached) {
+        gltf = ::load_gltf(path, material);
+        load_ms = clock.get_current_delta();
+        // 各网格并行构建，每个大网格的构建内部也会拆分成并行任务
+        SThreadPool::parallel_for(pool, 0, gltf.meshes.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                gltf.meshes[i].build(&pool);
+        });
+        if (accel_cache && !AccelCache::write(cache_path, key, gltf.meshes, gltf.instances))
+            cerr << "Failed to write acceleration structure cache: " << cache_path << endl;
+    }
+    // 网格已经建好BVH，直接放进图元表，不再经过add_mesh
+    uint32_t first_mesh = (uint32_t)prims.meshes.size();
+    size_t triangle_count = 0;
+    for (Mesh &mesh : gltf.meshes) {
+        triangle_count += mesh.triangle_count();
+        prims.meshes.push_back(std::move(mesh));
+    }
+    for (const auto &[mesh, node_transform] : gltf.instances)
+        add_instance(first_mesh + mesh, node_transform * transform);
+    if (!print_stats)
+        return;
+    cout << "glTF: " << path << ", " << gltf.meshes.size() << " meshes, " << triangle_count << " triangles, "
+         << gltf.instances.size() << " instances; ";
+    if (cached)
+        cout << "loaded from cache in " << load_ms << "ms" << endl;
+    else
+        cout << "loaded in " << load_ms << "ms, mesh BVHs built in " << clock.get_current_delta() - load_ms << "ms"
+             << endl;
+}
+
+AABB Scene::primitive_bounds(uint32_t id) const {
+    if (id < prims.spheres.size())
+        return prims.spheres[id].get_bounds();
+    id -= (uint32_t)prims.spheres.size();
+    if (id < prims.triangles.size())
+        return prims.triangles[id].get_bounds();
+    id -= (uint32_t)prims.triangles.size();
+    return prims.get_instance_bounds(prims.instances[id]);
+}
+
+void Scene::build_bvh() {
+    vector<AABB> boxes;
+    vector<uint32_t> refs;
+    for (uint32_t i = 0; i < prims.spheres.size(); i++)
+        refs.push_back(make_primitive_ref(PRIM_SPHERE, i));
+    for (uint32_t i = 0; i < prims.triangles.size(); i++)
+        refs.push_back(make_primitive_ref(PRIM_TRIANGLE, i));
+    for (uint32_t i = 0; i < prims.instances.size(); i++)
+        refs.push_back(make_primitive_ref(PRIM_INSTANCE, i));
+    for (uint32_t i = 0; i < refs.size(); i++)
+        boxes.push_back(primitive_bounds(i));
+    // BVH中的图元下标转换为图元引用
+    bvh.build(boxes, BVH_BINNED_SAH, &pool);
+    bvh.remap_primitives(refs);
+    moved_primitives.clear();
+    occluder_generation = new_occluder_generation();
+
+    const BVHBuildStats &stats = bvh.get_stats();
+    cout << "BVH: " << boxes.size() << " primitives, " << stats.node_count << " nodes, SAH cost " << stats.sah_cost
+         << ", built in " << stats.build_ms << "ms" << endl;
+    // 实例只保存变换，网格的三角形和BVH只存一份
+    if (!prims.instances.empty()) {
+        size_t mesh_bytes = 0, instanced_triangles = 0;
+        for (const auto &mesh : prims.meshes)
+            mesh_bytes += mesh.get_size_bytes();
+        for (const auto &instance : prims.instances)
+            instanced_triangles += prims.meshes[instance.mesh].triangle_count();
+        cout << "Instances: " << prims.instances.size() << " instances of " << prims.meshes.size() << " meshes, "
+             << instanced_triangles << " triangles; meshes " << mesh_bytes / 1024 << "KB, instance records "
+             << prims.instances.size() * sizeof(Instance) / 1024 << "KB, top-level BVH " << bvh.get_size_bytes() / 1024
+             << "KB (flattened triangles would need " << instanced_triangles * sizeof(Triange) / 1024 << "KB)"
+             << endl;
+    }
+
+    build_light_bvh();
+}
+
+void Scene::refit_bvh() {
+    if (moved_primitives.empty())
+        return;
+    bvh.refit(moved_primitives, [this](uint32_t id) { return primitive_bounds(id); }, &pool);
+    moved_primitives.clear();
+    // 图元位置变了，缓存的遮挡物和累积的样本都作废
+    occluder_generation = new_occluder_generation();
+    spp = 0;
+
+    if (!print_stats)
+        return;
+    const BVHRefitStats &stats = bvh.get_refit_stats();
+    cout << "BVH refit: " << stats.moved << " moved, " << stats.refitted_nodes << " nodes refitted, ";
+    if (stats.full_rebuild)
+        cout << "full rebuild";
+    else
+        cout << stats.rebuilt_subtrees << " subtrees (" << stats.rebuilt_primitives << " primitives) rebuilt";
+    cout << ", " << stats.refit_ms * 1000 << "us" << endl;
+}
+
+void Scene::build_light_bvh() {
+    vector<vec3> positions;
+    vector<float> powers;
+    for (const auto &light : point_lights) {
+        positions.push_back(light.position);
+        powers.push_back((light.Le.x + light.Le.y + light.Le.z) / 3);
+    }
+    light_bvh.build(positions, powers);
+    occluder_generation = new_occluder_generation();
+    spp = 0;
+}
+
+float Scene::light_sample_random(vec3 P, uint32_t k) const {
+    uint32_t bits[3];
+    memcpy(bits, &P, sizeof(bits));
+    uint32_t h = hash_uint(bits[0] + hash_uint(bits[1] + hash_uint(bits[2] + hash_uint(spp * 64 + k))));
+    return (h >> 8) * (1.0f / 16777216.0f);
 }
 
 void Scene::build() {
@@ -86,32 +610,29 @@ void Scene::build() {
     vec3 ks(2, 2, 2);
 
     // 三个球
-    objects.emplace_back(new Sphere(vec3(-2.0f, -1.0f, 2.0f), 0.5f, Material::ReflectiveMaterial(vec3(0.14, 0.16, 0.13), vec3(4.1, 2.3, 3.1))));
-    objects.emplace_back(new Sphere(vec3(0.0f, -1.5f, 2.0f), 0.5f, Material::ReflectiveMaterial(vec3(0.14, 0.16, 0.13), vec3(4.1, 2.3, 3.1))));
-    objects.emplace_back(new Sphere(vec3(2.0f, -1.5f, -2.0f), 0.5f, Material::RoughMaterial(vec3(1.0f, 1.0f, 1.0f), ks, 20)));
+    uint32_t mirror = add_material(Material::ReflectiveMaterial(vec3(0.14, 0.16, 0.13), vec3(4.1, 2.3, 3.1)));
+    add_sphere(vec3(-2.0f, -1.0f, 2.0f), 0.5f, mirror);
+    add_sphere(vec3(0.0f, -1.5f, 2.0f), 0.5f, mirror);
+    add_sphere(vec3(2.0f, -1.5f, -2.0f), 0.5f, add_material(Material::RoughMaterial(vec3(1.0f, 1.0f, 1.0f), ks, 20)));
 
-    mat4 R = RotationMatrix(22.5f, vec3(0.0f, 1.0f, 0.0f));
+    // 立方体网格只建立一次，由实例的变换放到场景中。原来的顶点写作R * v + V，
+    // 但mat4 * vec3不做变换，旋转从未生效；这里只做平移，保持原来的画面
 	vec3 V = vec3(2.0f, 0.0f, 2.0f);
-    Material mat = Material::TextureMaterial("cube.jpg", ks, 100);
-    add_cquad(R * vec3(-0.5f, -2.0f,  0.5f) + V, R * vec3( 0.5f, -2.0f,  0.5f) + V, R * vec3( 0.5f, -1.0f,  0.5f) + V, R * vec3(-0.5f, -1.0f,  0.5f) + V, mat);
-    add_cquad(R * vec3( 0.5f, -2.0f, -0.5f) + V, R * vec3(-0.5f, -2.0f, -0.5f) + V, R * vec3(-0.5f, -1.0f, -0.5f) + V, R * vec3( 0.5f, -1.0f, -0.5f) + V, mat);
-	add_cquad(R * vec3( 0.5f, -2.0f,  0.5f) + V, R * vec3( 0.5f, -2.0f, -0.5f) + V, R * vec3( 0.5f, -1.0f, -0.5f) + V, R * vec3( 0.5f, -1.0f,  0.5f) + V, mat);
-	add_cquad(R * vec3(-0.5f, -2.0f, -0.5f) + V, R * vec3(-0.5f, -2.0f,  0.5f) + V, R * vec3(-0.5f, -1.0f,  0.5f) + V, R * vec3(-0.5f, -1.0f, -0.5f) + V, mat);
-	add_cquad(R * vec3(-0.5f, -1.0f,  0.5f) + V, R * vec3( 0.5f, -1.0f,  0.5f) + V, R * vec3( 0.5f, -1.0f, -0.5f) + V, R * vec3(-0.5f, -1.0f, -0.5f) + V, mat);
-	add_cquad(R * vec3(-0.5f, -2.0f, -0.5f) + V, R * vec3( 0.5f, -2.0f, -0.5f) + V, R * vec3( 0.5f, -2.0f,  0.5f) + V, R * vec3(-0.5f, -2.0f,  0.5f) + V, mat);
+    uint32_t mat = add_material(Material::TextureMaterial("cube.jpg", ks, 100));
+    add_instance(add_mesh(Mesh::box(vec3(-0.5f, -2.0f, -0.5f), vec3(0.5f, -1.0f, 0.5f), mat)), TranslateMatrix(V));
 		
     //objects.emplace_back(new Triange(vec3( -50, -2,  50), vec3( 0, -2,  50), vec3( 0, -2,  0), Material::RoughMaterial(vec3(0.0f, 0.5f, 1.0f), ks, 100)));
     
-    add_cquad(vec3(-0.0f, -2.0f,  4.0f), vec3( 4.0f, -2.0f,  4.0f), vec3( 4.0f, -2.0f, -4.0f), vec3(-0.0f, -2.0f, -4.0f), Material::TextureMaterial("floor.jpg", ks, 50));
-	add_cquad(vec3(-4.0f, -2.0f,  4.0f), vec3( 0.0f, -2.0f,  4.0f), vec3( 0.0f, -2.0f,  0.0f), vec3(-4.0f, -2.0f,  0.0f), Material::TextureMaterial("floor.jpg", ks, 50));
+    add_cquad(vec3(-0.0f, -2.0f,  4.0f), vec3( 4.0f, -2.0f,  4.0f), vec3( 4.0f, -2.0f, -4.0f), vec3(-0.0f, -2.0f, -4.0f), add_material(Material::TextureMaterial("floor.jpg", ks, 50)));
+	add_cquad(vec3(-4.0f, -2.0f,  4.0f), vec3( 0.0f, -2.0f,  4.0f), vec3( 0.0f, -2.0f,  0.0f), vec3(-4.0f, -2.0f,  0.0f), add_material(Material::TextureMaterial("floor.jpg", ks, 50)));
 	
-    Material white = Material::RoughMaterial(vec3(1.0f, 1.0f, 1.0f), ks, 0);
+    uint32_t white = add_material(Material::RoughMaterial(vec3(1.0f, 1.0f, 1.0f), ks, 0));
     //add_cquad(vec3( 0.0f,  2.0f, -4.0f), vec3( 4.0f,  2.0f, -4.0f), vec3( 4.0f,  2.0f,  4.0f), vec3( 0.0f,  2.0f,  4.0f),white);
 	add_cquad(vec3(-4.0f,  2.0f,  0.0f), vec3( 0.0f,  2.0f,  0.0f), vec3( 0.0f,  2.0f,  4.0f), vec3(-4.0f,  2.0f,  4.0f),white);
 	add_cquad(vec3(-0.0f, -2.0f, -4.0f), vec3( 4.0f, -2.0f, -4.0f), vec3( 4.0f,  2.0f, -4.0f), vec3(-0.0f,  2.0f, -4.0f),white);
 	//add_cquad(vec3( 4.0f, -2.0f,  4.0f), vec3(-4.0f, -2.0f,  4.0f), vec3(-4.0f,  2.0f,  4.0f), vec3( 4.0f,  2.0f,  4.0f),white);
-	add_cquad(vec3( 4.0f, -2.0f, -4.0f), vec3( 4.0f, -2.0f,  4.0f), vec3( 4.0f,  2.0f,  4.0f), vec3( 4.0f,  2.0f, -4.0f),  Material::RoughMaterial(vec3(0.0f, 1.0f, 0.0f), ks, 0));
-	add_cquad(vec3(-4.0f, -2.0f,  4.0f), vec3(-4.0f, -2.0f, -0.0f), vec3(-4.0f,  2.0f, -0.0f), vec3(-4.0f,  2.0f,  4.0f),  Material::RoughMaterial(vec3(1.0f, 0.0f, 0.0f), ks, 0));
+	add_cquad(vec3( 4.0f, -2.0f, -4.0f), vec3( 4.0f, -2.0f,  4.0f), vec3( 4.0f,  2.0f,  4.0f), vec3( 4.0f,  2.0f, -4.0f),  add_material(Material::RoughMaterial(vec3(0.0f, 1.0f, 0.0f), ks, 0)));
+	add_cquad(vec3(-4.0f, -2.0f,  4.0f), vec3(-4.0f, -2.0f, -0.0f), vec3(-4.0f,  2.0f, -0.0f), vec3(-4.0f,  2.0f,  4.0f),  add_material(Material::RoughMaterial(vec3(1.0f, 0.0f, 0.0f), ks, 0)));
 	add_cquad(vec3(-4.0f, -2.0f,  0.0f), vec3( 0.0f, -2.0f,  0.0f), vec3( 0.0f,  2.0f,  0.0f), vec3(-4.0f,  2.0f,  0.0f),white);
 	add_cquad(vec3( 0.0f, -2.0f,  0.0f), vec3( 0.0f, -2.0f, -4.0f), vec3( 0.0f,  2.0f, -4.0f), vec3( 0.0f,  2.0f,  0.0f),white);
 
@@ -138,4 +659,10 @@ void Scene::build() {
     // vec3(4.1, 2.3, 3.1))));
     // objects.emplace_back(
     //     new Plane(vec3(0, -0.6, 0), vec3(0, 1, 0), Material::RoughMaterial(vec3(0.1, 0.2, 0.3), ks, 100)));
+
+    TextureCacheStats textures = TextureCache::instance().get_stats();
+    cout << "Textures: " << textures.loads << " loaded for " << textures.requests << " requests, " << textures.resident
+         << " resident, " << textures.resident_bytes / 1024 << "KB" << endl;
+
+    build_bvh();
 }
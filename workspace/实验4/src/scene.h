@@ -1,12 +1,44 @@
 #pragma once
-#include <GL/glew.h>		
-#include <GL/glut.h>	
 #include "Intersectable.h"
+#include "BVH.h"
+#include "LightBVH.h"
+#include "PrimitiveStore.h"
+#include "TileScheduler.h"
+#include "Random.h"
+#include "Sampler.h"
 
+#include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
 #include "global.h"
 
+// 当前线程求交过的光线数量（包括阴影光线），用于统计每秒光线数
+extern thread_local uint64_t thread_ray_count;
+
+// 反射/折射的最大深度，更深的光线直接取环境光
+const uint32_t max_trace_depth = 5;
+// 迭代追踪时显式栈的大小，每追踪一条光线最多压入两条，深度有限时栈不会超过这个大小
+const uint32_t trace_stack_size = 2 * (max_trace_depth + 1);
+
+// 每个深度上追踪的光线数和被剔除（权重过小、轮盘赌终止或超过最大深度）的光线数
+struct TraceStats {
+    uint64_t traced[max_trace_depth + 2] = {};
+    uint64_t culled[max_trace_depth + 2] = {};
+};
+
+// 积分方法
+enum Integrator {
+    INTEGRATOR_WHITTED, // Whitted光线追踪：Phong模型加硬阴影，镜面反射和折射
+    INTEGRATOR_PATH     // 蒙特卡洛路径追踪：对光源直接采样(NEE)，与BSDF采样做多重重要性采样(MIS)
+};
+
+// 点光源的采样方式
+enum LightSampling {
+    LIGHTS_EXACT, // 每个着色点对所有点光源各发一条阴影光线，作为参考
+    LIGHTS_BVH    // 用光源BVH按估计的贡献抽取light_samples个点光源，代价与光源数量基本无关
+};
+
 //---------------------------
 // 定义光源
 struct DirectionalLight {
@@ -27,17 +59,39 @@ class ViewPoint {		// 表示用户视线
 	// eye用来定义用户位置，即视点；lookat(视线中心)，right和up共同定义了视窗大小
 	vec3 eye, lookat, right, up;		
 	float fov;
+	// 画面分辨率
+	uint32_t width = windowWidth, height = windowHeight;
+	// 视点每次变化时加1，渐进渲染据此判断是否需要重新累积
+	uint32_t revision = 0;
 
 public:
 	// 获得屏幕上某点的光线
 	Ray getRay(int X, int Y)
 	{
-		vec3 dir = lookat + right * (2 * (X + 0.5f) / windowWidth - 1) + 
-						up * (2 * (Y + 0.5f) / windowHeight - 1) - eye;
+		return getRay(X, Y, 0.5f, 0.5f);
+	}
+
+	// 获得像素(X, Y)内偏移(dx, dy)处的光线，dx, dy在[0, 1)之间
+	Ray getRay(int X, int Y, float dx, float dy)
+	{
+		// 宽高不同时按宽高比拉伸水平方向，保持像素为正方形
+		float aspect = (float)width / height;
+		vec3 dir = lookat + right * ((2 * (X + dx) / width - 1) * aspect) + 
+						up * (2 * (Y + dy) / height - 1) - eye;
 						
 		return Ray(eye, dir);
 	}
 
+	uint32_t get_revision() const { return revision; }
+	// 一个像素对应的视角（弧度），光线在距离t处的footprint宽度约为t * pixel_angle()
+	float pixel_angle() const { return 2 * tanf(fov / 2) / height; }
+
+	void set_resolution(uint32_t _width, uint32_t _height)
+	{
+		width = _width;
+		height = _height;
+	}
+
 	// 设置视点位置、fov视域角等参数
 	void set(vec3 _eye, vec3 _lookat, vec3 _up, float _fov)	
 	{
@@ -49,19 +103,27 @@ public:
 		// 要确保up、right与eye到lookat的向量垂直(所以叉乘)
 		right = normalize(cross(_up, w)) * windowSize;	
 		up = normalize(cross(w, right)) * windowSize;
+		revision++;
 	}
 
 
 	void animate(float dt)		// 修改eye的位置（旋转）
 	{
 		vec3 d = eye - lookat;
-		eye = vec3(d.x * cos(dt) + d.z * sin(dt), d.y, -d.x * sin(dt) + d.z * cos(dt)) + lookat;
+		vec3 new_eye = vec3(d.x * cos(dt) + d.z * sin(dt), d.y, -d.x * sin(dt) + d.z * cos(dt)) + lookat;
+		// 位置没有变化时不更新，避免打断渐进渲染
+		if (new_eye == eye)
+			return;
+		eye = new_eye;
 		set(eye, lookat, up, fov);
 	}
 
 	void zoomInOut(float dz)		// 修改eye的位置
 	{
-		eye = eye + normalize(eye - lookat) * dz;
+		vec3 new_eye = eye + normalize(eye - lookat) * dz;
+		if (new_eye == eye)
+			return;
+		eye = new_eye;
 		set(eye, lookat, up, fov);
 		//cout << "\t" << eye.z << " " << dz << endl;
 	
@@ -70,95 +132,344 @@ public:
 //---------------------------
 // 场景，物品和光源集合
 class Scene {
-	vector<std::unique_ptr<Intersectable>> objects; // 物品
+	PrimitiveStore prims;     // 物品，按类型分别存放
+	vector<Material> materials; // 材质表，物品通过下标引用
+	BVH bvh;                  // 球、三角形和实例的层次包围盒（顶层），叶子中保存图元引用；平面无界，不进入BVH，每次都要求交
+	vector<uint32_t> moved_primitives; // 移动后还没有更新到BVH中的图元，按build_bvh时的顺序编号
 	// 光源
 	vector<DirectionalLight> direction_lights;
     vector<PointLight> point_lights;
+	LightBVH light_bvh;       // 点光源的层次结构
+	LightSampling light_sampling = LIGHTS_BVH;
+	uint32_t light_samples = 4; // 每个着色点抽取的点光源数，点光源不多于此数时总是遍历全部
 	ViewPoint viewPoint;
 	vec3 La;		// 环境光
+	uint32_t width = windowWidth, height = windowHeight; // 渲染分辨率，默认与窗口相同
+	std::atomic<uint64_t> frame_ray_count{0}; // 上一帧的光线数量
+	float frame_ms = 0;         // 上一帧的用时
+	bool print_stats = true;    // 每帧结束后是否打印统计
+	bool accel_cache = false;   // load_gltf是否使用加速结构的磁盘缓存
+	// 渐进渲染：视点不变时每帧给每个像素追加一个抖动的样本，显示所有样本的平均值
+	bool progressive = false;
+	vector<vec3> accumulation;  // 每个像素的样本之和
+	uint32_t spp = 0;           // 已累积的每像素样本数
+	uint32_t accumulated_view = 0; // 累积开始时视点的revision
+	// 反射/折射分支的累积权重（各分量的最大值）低于该值时不再追踪，用环境光近似
+	float fresnel_cutoff = 0.01f;
+	// 俄罗斯轮盘赌：从第roulette_depth层开始按权重随机终止分支，存活的分支除以存活概率
+	bool russian_roulette = false;
+	uint32_t roulette_depth = 2;
+	std::atomic<uint64_t> frame_traced[max_trace_depth + 2] = {}; // 上一帧每个深度的统计
+	std::atomic<uint64_t> frame_culled[max_trace_depth + 2] = {};
+	// 各线程缓存的遮挡物所对应的场景状态。加速结构或光源改变时换成新值使缓存失效；
+	// 取自全局计数器，所有Scene的值都不相同，线程缓存不会误用另一个场景的图元
+	uint64_t occluder_generation = new_occluder_generation();
+	TextureFilter texture_filter = TEXTURE_TRILINEAR;
+	Integrator integrator = INTEGRATOR_WHITTED;
+	Sampler sampler;            // 像素内抖动和路径追踪使用的样本
+	uint32_t target_spp = 0;    // 渐进渲染累积到该样本数后停止，0表示不限
+	bool packet_tracing = true; // 主光线是否以光线包为单位追踪
+	TileScheduler scheduler;    // 分块渲染的调度
 public:
 	// 初始化函数，定义了用户(摄像机)的初始位置，环境光La，方向光源集合、物品集合中添加物件
     void build();
 
-    void add_cquad(vec3 a, vec3 b, vec3 c, vec3 d, Material mat);
+    // 添加材质，返回材质下标
+    uint32_t add_material(const Material &material) {
+        materials.push_back(material);
+        return (uint32_t)materials.size() - 1;
+    }
+    void add_sphere(vec3 center, float radius, uint32_t mat) { prims.spheres.emplace_back(center, radius, mat); }
+    void add_plane(vec3 p0, vec3 normal, uint32_t mat) { prims.planes.emplace_back(p0, normal, mat); }
+    void add_cquad(vec3 a, vec3 b, vec3 c, vec3 d, uint32_t mat);
+    // 添加网格并建立它的BVH，返回网格下标；网格通过add_instance放到场景中，可以放多次
+    uint32_t add_mesh(Mesh mesh) {
+        mesh.build();
+        prims.meshes.push_back(std::move(mesh));
+        return (uint32_t)prims.meshes.size() - 1;
+    }
+    void add_instance(uint32_t mesh, const mat4 &transform) { prims.instances.emplace_back(mesh, transform); }
+    // 读入glTF文件中的网格，按文件中的节点作为实例放到场景中，transform再把整个模型放到世界空间。
+    // 所有三角形使用材质material，读入后需要调用build_bvh。启用缓存时网格和它们的BVH保存在模型旁边的
+    // .rtcache文件中，模型不变时下次直接从缓存读取
+    void load_gltf(const std::string &path, uint32_t material, const mat4 &transform);
+    void set_accel_cache(bool enabled) { accel_cache = enabled; }
+    // 建立BVH之后移动球或实例，下一帧渲染前refit BVH
+    void move_sphere(uint32_t index, vec3 center) {
+        prims.spheres[index].center = center;
+        moved_primitives.push_back(index);
+    }
+    void set_instance_transform(uint32_t index, const mat4 &transform) {
+        prims.instances[index] = Instance(prims.instances[index].mesh, transform);
+        moved_primitives.push_back((uint32_t)(prims.spheres.size() + prims.triangles.size()) + index);
+    }
+    // 添加点光源，添加完毕后需要调用build_light_bvh
+    void add_point_light(vec3 position, vec3 Le) {
+        point_lights.emplace_back(position, Le);
+        occluder_generation = new_occluder_generation();
+    }
+
+    // 物品添加完毕后建立加速结构，同时建立光源BVH
+    void build_bvh();
+    // 按移动过的图元增量更新BVH，render开始时自动调用
+    void refit_bvh();
+    void build_light_bvh();
+    size_t get_point_light_count() const { return point_lights.size(); }
+    // 图元和顶层BVH，供基准程序绕过Scene直接求交
+    const PrimitiveStore &get_primitives() const { return prims; }
+    const BVH &get_bvh() const { return bvh; }
+
+    // 点光源的采样方式，切换时重新开始累积
+    void set_light_sampling(LightSampling mode) {
+        light_sampling = mode;
+        spp = 0;
+    }
+    LightSampling get_light_sampling() const { return light_sampling; }
+    void set_light_samples(uint32_t count) {
+        light_samples = std::max(count, 1u);
+        spp = 0;
+    }
+    uint32_t get_light_samples() const { return light_samples; }
 
-    // 渲染视窗上每个点的着色(逐像素调用trace函数)
+    // 渲染视窗上每个点的着色(分块后逐像素调用trace函数，或者逐光线包调用trace_packet)，
+    // image按行存放width x height个像素，第0行在最下面
     void render(vector<vec4> &image);
+
+    // 设置渲染分辨率，可以与窗口大小不同
+    void set_resolution(uint32_t _width, uint32_t _height) {
+        width = _width;
+        height = _height;
+        viewPoint.set_resolution(width, height);
+    }
+    uint32_t get_width() const { return width; }
+    uint32_t get_height() const { return height; }
+    // 视点每次变化时加1
+    uint32_t get_view_revision() const { return viewPoint.get_revision(); }
+
+    // 渐进渲染的开关，切换时重新开始累积
+    void set_progressive(bool enable) {
+        progressive = enable;
+        spp = 0;
+    }
+    bool get_progressive() const { return progressive; }
+    // 当前显示的图像每个像素的样本数
+    uint32_t get_spp() const { return progressive ? spp : 1; }
+    // 渐进渲染的目标样本数，达到后render不再追踪光线，0表示不限
+    void set_target_spp(uint32_t count) { target_spp = count; }
+    uint32_t get_target_spp() const { return target_spp; }
+
+    // 切换积分方法，重新开始累积
+    void set_integrator(Integrator i) {
+        integrator = i;
+        spp = 0;
+    }
+    Integrator get_integrator() const { return integrator; }
+
+    // 切换采样器，重新开始累积
+    void set_sampler(const Sampler &s) {
+        sampler = s;
+        spp = 0;
+    }
+    const Sampler &get_sampler() const { return sampler; }
+
+    // 反射/折射分支的剔除
+    void set_fresnel_cutoff(float cutoff) { fresnel_cutoff = cutoff; }
+    float get_fresnel_cutoff() const { return fresnel_cutoff; }
+    void set_russian_roulette(bool enable) { russian_roulette = enable; }
+    bool get_russian_roulette() const { return russian_roulette; }
+    // 上一帧每个深度追踪和剔除的光线数
+    TraceStats get_trace_stats() const;
+
+    // 贴图的过滤方式
+    void set_texture_filter(TextureFilter filter) { texture_filter = filter; }
+    TextureFilter get_texture_filter() const { return texture_filter; }
+
+    // 上一帧的统计
+    uint64_t get_frame_ray_count() const { return frame_ray_count; }
+    float get_frame_ms() const { return frame_ms; }
+    void set_print_stats(bool enable) { print_stats = enable; }
+
+    // 切换主光线的追踪方式，用于比较光线包与逐条追踪的性能
+    void set_packet_tracing(bool enable) { packet_tracing = enable; }
+    bool get_packet_tracing() const { return packet_tracing; }
+    // 分块大小和顺序
+    TileScheduler &get_scheduler() { return scheduler; }
         // 求最近的交点
 	Hit firstIntersect(Ray ray)		
 	{
-		Hit bestHit;
-		for (auto& object : objects)
-		{
-			Hit hit = object->intersect(ray);
-			if (hit.s > 0 && (bestHit.s < 0 || hit.s < bestHit.s))
-				bestHit = hit;
-		}
+		thread_ray_count++;
+		// 遍历时只记录最近交点的距离和图元，交点的其他信息最后只对最近的图元计算一次
+		float best_s = -1;
+		uint32_t best_id = 0, best_element = 0;
+		// 距离相同时取引用小的图元，结果与遍历顺序无关
+		auto update = [&](float s, uint32_t id, uint32_t element) {
+			if (s > 0 && (best_s < 0 || s < best_s || (s == best_s && id < best_id))) {
+				best_s = s;
+				best_id = id;
+				best_element = element;
+			}
+		};
+		for (uint32_t i = 0; i < prims.planes.size(); i++)
+			update(prims.planes[i].distance(ray), make_primitive_ref(PRIM_PLANE, i), 0);
+		bvh.closest(ray, [&](uint32_t id) {
+			uint32_t element = 0;
+			float s = prims.distance(id, ray, best_s < 0 ? FLT_MAX : best_s, element);
+			update(s, id, element);
+			return best_s < 0 ? FLT_MAX : best_s;
+		});
+		if (best_s < 0)
+			return Hit();
 
+		Hit bestHit = prims.finalize_hit(best_id, best_element, ray, best_s);
 		// 光线与交点的点积大于0，夹角为锐角
 		if (dot(ray.dir, bestHit.normal) > 0)
 			bestHit.normal = bestHit.normal * (-1);
 
 		return bestHit;
 	}
-	// 该射线在指向光源的路径上是否与其他物体有交
-	bool shadowIntersect(Ray ray)	
+	// 光线包求最近交点，rays为包中的PACKET_SIZE条光线，结果与逐条调用firstIntersect相同
+	void firstIntersect(const Ray *rays, Hit *hits)
 	{
-		for (auto& object : objects)
-			if (object->intersect(ray).s > 0)
-				return true;
-		return false;
+		thread_ray_count += PACKET_SIZE;
+		RayPacket packet;
+		float start[3][PACKET_SIZE], dir[3][PACKET_SIZE], inv_dir[3][PACKET_SIZE];
+		for (int i = 0; i < PACKET_SIZE; i++) {
+			vec3 inv = safe_inverse(rays[i].dir);
+			for (int k = 0; k < 3; k++) {
+				start[k][i] = rays[i].start[k];
+				dir[k][i] = rays[i].dir[k];
+				inv_dir[k][i] = inv[k];
+			}
+		}
+		packet.start = vec3p(vfloat::load(start[0]), vfloat::load(start[1]), vfloat::load(start[2]));
+		packet.dir = vec3p(vfloat::load(dir[0]), vfloat::load(dir[1]), vfloat::load(dir[2]));
+		packet.inv_dir = vec3p(vfloat::load(inv_dir[0]), vfloat::load(inv_dir[1]), vfloat::load(inv_dir[2]));
+
+		PacketHit packet_hit;
+		for (uint32_t i = 0; i < prims.planes.size(); i++)
+			prims.planes[i].intersect_packet(packet, packet_hit, make_primitive_ref(PRIM_PLANE, i));
+		bvh.closest(packet, packet_hit.s, [&](uint32_t id) {
+			prims.intersect_packet(id, packet, packet_hit);
+			return packet_hit.s;
+		});
+
+		// 只有最近的图元需要完整的交点信息，用标量求交补全（实例还要找到命中的三角形）
+		uint32_t ids[PACKET_SIZE];
+		packet_hit.get_ids(ids);
+		for (int i = 0; i < PACKET_SIZE; i++) {
+			hits[i] = Hit();
+			if (ids[i] == UINT32_MAX)
+				continue;
+			uint32_t element = 0;
+			float s = prims.distance(ids[i], rays[i], FLT_MAX, element);
+			hits[i] = prims.finalize_hit(ids[i], element, rays[i], s);
+			if (dot(rays[i].dir, hits[i].normal) > 0)
+				hits[i].normal = hits[i].normal * (-1);
+		}
 	}
+	// 该射线在到达光源（距离max_distance）之前是否与其他物体有交。
+	// light为光源编号（方向光在前，点光源在后，最后是环境光），先测试当前线程上次遮挡该光源的图元
+	bool shadowIntersect(const Ray &ray, float max_distance, uint32_t light);
 	// 光线追踪算法主体代码
-    vec3 trace(Ray ray, int depth = 0);
+    vec3 trace(const Ray &ray) { return trace(ray, firstIntersect(ray)); }
+    // 从已知的第一个交点开始追踪，反射和折射光线放在固定大小的栈中迭代处理
+    vec3 trace(const Ray &ray, const Hit &hit);
+    // 路径追踪：从已知的第一个交点开始，每次弹射对光源直接采样，再按BSDF采样下一个方向
+    vec3 trace_path(const Ray &ray, const Hit &hit, SampleStream &samples);
+    // 按当前的积分方法计算像素(X, Y)的主光线带回的颜色
+    vec3 radiance(const Ray &ray, const Hit &hit, uint32_t X, uint32_t Y);
+    // 追踪以(X, Y)为左下角的PACKET_WIDTH x PACKET_HEIGHT像素块的主光线，超出tile的像素不写入
+    void trace_packet(uint32_t X, uint32_t Y, const Tile &tile, vector<vec4> &image);
+    // 像素(X, Y)本帧的主光线，渐进渲染和路径追踪时在像素内抖动，使用样本的前两维
+    Ray primary_ray(uint32_t X, uint32_t Y);
+    // 写入像素(X, Y)本帧的颜色，渐进渲染时写入累积的平均值
+    void store_pixel(vector<vec4> &image, uint32_t X, uint32_t Y, vec3 color);
+
+    // 对可能照亮着色点(P, N)的点光源调用fn(light, weight)。精确模式或点光源不多于light_samples个时
+    // 遍历全部点光源，weight为1；否则用光源BVH有放回地抽取light_samples个，weight为1 / (light_samples * pmf)，
+    // 期望与遍历全部相同。随机数取决于着色点位置和样本序号，渐进渲染时会收敛
+    template <typename Fn> void for_each_point_light(vec3 P, vec3 N, Fn &&fn) {
+        if (light_sampling == LIGHTS_EXACT || point_lights.size() <= light_samples) {
+            for (uint32_t i = 0; i < point_lights.size(); i++)
+                fn(i, 1.0f);
+            return;
+        }
+        for (uint32_t k = 0; k < light_samples; k++) {
+            uint32_t light;
+            float pmf;
+            if (light_bvh.sample(P, N, light_sample_random(P, k), light, pmf))
+                fn(light, 1.0f / (light_samples * pmf));
+        }
+    }
+    // 着色点P第k次抽取点光源用的随机数
+    float light_sample_random(vec3 P, uint32_t k) const;
+    // BVH中第id个图元（依次是球、三角形、实例）的包围盒
+    AABB primitive_bounds(uint32_t id) const;
+    // 全局唯一的遮挡物缓存版本号
+    static uint64_t new_occluder_generation();
+
+    // 粗糙材质在交点处的漫反射系数，cone_width为光线在交点处的footprint宽度，用于选择贴图的mip层级
+    vec3 diffuse_color(vec3 V, const Hit &hit, float cone_width) {
+        const Material &material = materials[hit.material];
+        if (material.type == ROUGH)
+            return material.kd;
+        // footprint换算成纹素数，斜着看表面时footprint被拉长
+        float cos_view = std::max(fabsf(dot(V, hit.normal)), 1e-3f);
+        float lod = material.texture->get_log2_size() + hit.uv_lod + log2f(cone_width / cos_view);
+        return material.texture->sample(hit.uv, lod, texture_filter);
+    }
 
-    vec3 phong_shading(vec3 V, const Hit& hit){
-        vec3 kd = hit.material->type == ROUGH ? hit.material->kd : sample_image(hit.material->texture, hit.uv);
+    vec3 phong_shading(vec3 V, const Hit& hit, float cone_width){
+        const Material &material = materials[hit.material];
+        vec3 kd = diffuse_color(V, hit, cone_width);
         
         // 环境光
         vec3 outRadiance = kd * La;
 
         // 方向光
-        for (const auto &light : direction_lights) {
+        for (uint32_t i = 0; i < direction_lights.size(); i++) {
+            const auto &light = direction_lights[i];
             vec3 L = light.direction;
             Ray shadowRay(hit.position + hit.normal * epsilon, L);
             float cosTheta = dot(hit.normal, L);
             // 如果cos小于0（钝角），说明光照到的是物体背面，用户看不到
             if (cosTheta > 0) {
                 // 如果与其他物体有交，则处于阴影中；反之按Phong模型计算
-                if (!shadowIntersect(shadowRay)) {
+                if (!shadowIntersect(shadowRay, FLT_MAX, i)) {
                     // 漫反射
                     outRadiance += light.Le * kd * cosTheta;
                     // 高光
                     vec3 H = normalize(V + L);
                     float cosDelta = dot(hit.normal, H);
                     if (cosDelta > 0)
-                        outRadiance += light.Le * hit.material->ks * powf(cosDelta, hit.material->shininess);
+                        outRadiance += light.Le * material.ks * powf(cosDelta, material.shininess);
                 }
             }
         }
 
         // 点光源
-        for (const auto &light : point_lights) {
+        for_each_point_light(hit.position, hit.normal, [&](uint32_t i, float weight) {
+            const auto &light = point_lights[i];
+            vec3 Le = light.Le * weight; // 抽样时按选中的概率放大
             vec3 light_direction = light.position - hit.position;
             vec3 L = normalize(light_direction);
             Ray shadowRay(hit.position + hit.normal * epsilon, L);
             float cosTheta = dot(hit.normal, L);
             // 如果cos小于0（钝角），说明光照到的是物体背面，用户看不到
             if (cosTheta > 0) {
-                // 如果与其他物体有交，则处于阴影中；反之按Phong模型计算
-                if (!shadowIntersect(shadowRay)) {
+                // 如果与其他物体有交，则处于阴影中；光源后面的物体不会遮挡；反之按Phong模型计算
+                if (!shadowIntersect(shadowRay, length(light_direction), (uint32_t)direction_lights.size() + i)) {
                     // 漫反射
                     float squared_distance = length(light_direction); // 使用线性光衰
-                    outRadiance += light.Le * kd * cosTheta / squared_distance;
+                    outRadiance += Le * kd * cosTheta / squared_distance;
                     // 高光
                     vec3 H = normalize(V + L);
                     float cosDelta = dot(hit.normal, H);
                     if (cosDelta > 0)
-                        outRadiance += light.Le * hit.material->ks * powf(cosDelta, hit.material->shininess) / squared_distance;
+                        outRadiance += Le * material.ks * powf(cosDelta, material.shininess) / squared_distance;
                 }
             }
-        }
+        });
         
         return outRadiance;
     }
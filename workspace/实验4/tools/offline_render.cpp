@@ -0,0 +1,331 @@
+// 离线渲染：不创建窗口，按命令行给定的分辨率渲染若干帧并保存为PNG或EXR，
+// 输出每帧用时和每秒光线数，用于没有GPU的机器上批量渲染和测性能
+#include "scene.h"
+
+#include <FreeImage.h>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct Options {
+    uint32_t width = windowWidth, height = windowHeight;
+    uint32_t frames = 1;
+    std::string output = "frame.png"; // 为空时不保存
+    bool packet_tracing = true;
+    bool progressive = false;
+    bool path_tracing = false;
+    SamplerType sampler = SAMPLER_SOBOL;
+    uint32_t extra_lights = 0; // 额外散布在场景中的点光源数量
+    bool exact_lights = false;
+    uint32_t light_samples = 4;
+    uint32_t cubes = 0; // 额外放在地面上的立方体实例数量
+    std::string gltf;   // 放在地面上的glTF模型，为空时不放
+    bool accel_cache = true; // 模型的网格和BVH缓存在模型旁边的.rtcache文件中
+    uint32_t tile_size = 16;
+    float animate = 0; // 每帧相机绕场景旋转的弧度
+    bool bounce = false; // 每帧让场景中的球上下跳动，BVH逐帧refit
+};
+
+static void print_usage(const char *program) {
+    std::cout << "usage: " << program << " [options]\n"
+              << "  -w, --width N      image width (default " << windowWidth << ")\n"
+              << "  -h, --height N     image height (default " << windowHeight << ")\n"
+              << "  -n, --frames N     number of frames to render (default 1)\n"
+              << "  -o, --output FILE  output .png or .exr; with several frames the frame index is\n"
+              << "                     appended to the file name (default frame.png)\n"
+              << "      --no-output    do not write images, only measure\n"
+              << "      --scalar       trace primary rays one by one instead of packets\n"
+              << "      --progressive  accumulate one jittered sample per pixel per frame\n"
+              << "      --path         path tracing with next-event estimation instead of Whitted\n"
+              << "                     ray tracing; combine with --progressive to converge\n"
+              << "      --sampler S    independent, sobol or blue-noise (default sobol)\n"
+              << "      --point-lights N  scatter N extra point lights in the room\n"
+              << "      --light-samples K point lights sampled per shading point (default 4)\n"
+              << "      --exact-lights shade with every point light instead of sampling\n"
+              << "      --cubes N      scatter N instances of one cube mesh on the floor\n"
+              << "      --gltf FILE    place the meshes of a glTF model on the floor\n"
+              << "      --no-cache     rebuild the model's BVHs instead of using FILE.rtcache\n"
+              << "      --tile N       tile size for the scheduler (default 16)\n"
+              << "      --animate R    rotate the camera by R radians after every frame\n"
+              << "      --bounce       move the spheres every frame and refit the BVH\n";
+}
+
+// 单边最多的像素数，更大的分辨率一帧的缓冲就要好几GB
+static const uint32_t max_resolution = 16384;
+
+// 非负整数参数。std::stoul会接受负数并把它变成很大的正数，所以先排除负号；
+// 不是整数、后面有多余的字符或超出uint32_t的范围时抛出异常
+static uint32_t parse_uint(const std::string &text) {
+    size_t first = text.find_first_not_of(" \t");
+    if (first != std::string::npos && text[first] == '-')
+        throw std::invalid_argument("negative value");
+    size_t end = 0;
+    unsigned long long value = std::stoull(text, &end);
+    if (end != text.size())
+        throw std::invalid_argument("trailing characters");
+    if (value > UINT32_MAX)
+        throw std::out_of_range("value too large");
+    return (uint32_t)value;
+}
+
+static bool parse_options(int argc, char *argv[], Options &options) {
+    // parse_uint和std::stof遇到不合法的值会抛出异常，当作参数错误处理；此时argv[i]是出错的值
+    int i = 1;
+    try {
+        for (; i < argc; i++) {
+            std::string arg = argv[i];
+            auto value = [&]() -> const char * {
+                if (i + 1 >= argc) {
+                    std::cerr << "missing value for " << arg << std::endl;
+                    return nullptr;
+                }
+                return argv[++i];
+            };
+            const char *v = nullptr;
+            if (arg == "-w" || arg == "--width") {
+                if (!(v = value()))
+                    return false;
+                options.width = parse_uint(v);
+            } else if (arg == "-h" || arg == "--height") {
+                if (!(v = value()))
+                    return false;
+                options.height = parse_uint(v);
+            } else if (arg == "-n" || arg == "--frames") {
+                if (!(v = value()))
+                    return false;
+                options.frames = parse_uint(v);
+            } else if (arg == "-o" || arg == "--output") {
+                if (!(v = value()))
+                    return false;
+                options.output = v;
+            } else if (arg == "--no-output") {
+                options.output.clear();
+            } else if (arg == "--scalar") {
+                options.packet_tracing = false;
+            } else if (arg == "--progressive") {
+                options.progressive = true;
+            } else if (arg == "--path") {
+                options.path_tracing = true;
+            } else if (arg == "--point-lights") {
+                if (!(v = value()))
+                    return false;
+                options.extra_lights = parse_uint(v);
+            } else if (arg == "--light-samples") {
+                if (!(v = value()))
+                    return false;
+                options.light_samples = parse_uint(v);
+            } else if (arg == "--cubes") {
+                if (!(v = value()))
+                    return false;
+                options.cubes = parse_uint(v);
+            } else if (arg == "--gltf") {
+                if (!(v = value()))
+                    return false;
+                options.gltf = v;
+            } else if (arg == "--no-cache") {
+                options.accel_cache = false;
+            } else if (arg == "--bounce") {
+                options.bounce = true;
+            } else if (arg == "--exact-lights") {
+                options.exact_lights = true;
+            } else if (arg == "--sampler") {
+                if (!(v = value()))
+                    return false;
+                bool found = false;
+                for (SamplerType type : {SAMPLER_INDEPENDENT, SAMPLER_SOBOL, SAMPLER_BLUE_NOISE}) {
+                    if (Sampler::get_name(type) == std::string(v)) {
+                        options.sampler = type;
+                        found = true;
+                    }
+                }
+                if (!found) {
+                    std::cerr << "unknown sampler: " << v << std::endl;
+                    return false;
+                }
+            } else if (arg == "--tile") {
+                if (!(v = value()))
+                    return false;
+                options.tile_size = parse_uint(v);
+            } else if (arg == "--animate") {
+                if (!(v = value()))
+                    return false;
+                options.animate = std::stof(v);
+            } else {
+                std::cerr << "unknown option: " << arg << std::endl;
+                return false;
+            }
+        }
+    } catch (const std::exception &) {
+        std::cerr << "invalid value for " << argv[i - 1] << ": " << argv[i] << std::endl;
+        return false;
+    }
+    if (options.width == 0 || options.height == 0 || options.width > max_resolution ||
+        options.height > max_resolution) {
+        std::cerr << "width and height must be between 1 and " << max_resolution << std::endl;
+        return false;
+    }
+    if (!options.output.empty()) {
+        FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(options.output.c_str());
+        if (format != FIF_PNG && format != FIF_EXR) {
+            std::cerr << "unsupported output format (use .png or .exr): " << options.output << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 多帧时在扩展名前加上帧号：frame.png -> frame_0003.png
+static std::string frame_path(const std::string &output, uint32_t frame, uint32_t frames) {
+    if (frames <= 1)
+        return output;
+    char index[16];
+    snprintf(index, sizeof(index), "_%04u", frame);
+    size_t dot = output.find_last_of('.');
+    size_t slash = output.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return output + index;
+    return output.substr(0, dot) + index + output.substr(dot);
+}
+
+// 保存渲染结果，PNG截断到[0, 1]后按8位保存，EXR保存原始的浮点值。
+// image的第0行在最下面，与FreeImage的行顺序相同
+static bool save_image(const std::string &path, const std::vector<vec4> &image, uint32_t width, uint32_t height) {
+    FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(path.c_str());
+    FIBITMAP *bitmap = nullptr;
+    if (format == FIF_PNG) {
+        bitmap = FreeImage_Allocate(width, height, 24);
+        for (uint32_t y = 0; y < height; y++) {
+            BYTE *line = FreeImage_GetScanLine(bitmap, y);
+            for (uint32_t x = 0; x < width; x++, line += 3) {
+                const vec4 &c = image[y * width + x];
+                auto to_byte = [](float v) { return (BYTE)(std::min(std::max(v, 0.0f), 1.0f) * 255.0f + 0.5f); };
+                line[FI_RGBA_RED] = to_byte(c.x);
+                line[FI_RGBA_GREEN] = to_byte(c.y);
+                line[FI_RGBA_BLUE] = to_byte(c.z);
+            }
+        }
+    } else if (format == FIF_EXR) {
+        bitmap = FreeImage_AllocateT(FIT_RGBAF, width, height);
+        for (uint32_t y = 0; y < height; y++) {
+            FIRGBAF *line = (FIRGBAF *)FreeImage_GetScanLine(bitmap, y);
+            for (uint32_t x = 0; x < width; x++) {
+                const vec4 &c = image[y * width + x];
+                line[x] = {c.x, c.y, c.z, c.w};
+            }
+        }
+    } else {
+        return false;
+    }
+    bool ok = bitmap != nullptr && FreeImage_Save(format, bitmap, path.c_str(), 0);
+    if (bitmap != nullptr)
+        FreeImage_Unload(bitmap);
+    if (!ok)
+        std::cerr << "failed to save image: " << path << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--help") {
+            print_usage(argv[0]);
+            return 0;
+        }
+    }
+    if (!parse_options(argc, argv, options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    scene.set_resolution(options.width, options.height);
+    scene.build();
+    scene.set_packet_tracing(options.packet_tracing);
+    scene.set_progressive(options.progressive);
+    scene.set_integrator(options.path_tracing ? INTEGRATOR_PATH : INTEGRATOR_WHITTED);
+    scene.set_sampler(Sampler(options.sampler));
+    if (options.extra_lights > 0) {
+        // 在房间里随机散布彩色的点光源，总强度与场景原有的点光源相当
+        PCG32 rng(7, 0);
+        for (uint32_t i = 0; i < options.extra_lights; i++) {
+            vec3 position(rng.next_float() * 8 - 4, rng.next_float() * 4 - 2, rng.next_float() * 8 - 4);
+            vec3 color(0.2f + 0.8f * rng.next_float(), 0.2f + 0.8f * rng.next_float(), 0.2f + 0.8f * rng.next_float());
+            scene.add_point_light(position, color * (2.0f / options.extra_lights));
+        }
+        scene.build_light_bvh();
+    }
+    if (options.cubes > 0) {
+        // 同一个立方体网格的实例，在地面的一块区域上排成网格，随机缩放和绕y轴旋转
+        uint32_t material = scene.add_material(Material::RoughMaterial(vec3(0.6f, 0.5f, 0.3f), vec3(0.2f, 0.2f, 0.2f), 20));
+        uint32_t cube = scene.add_mesh(Mesh::box(vec3(-0.5f, 0.0f, -0.5f), vec3(0.5f, 1.0f, 0.5f), material));
+        uint32_t side = (uint32_t)ceilf(sqrtf((float)options.cubes));
+        float spacing = 3.6f / side;
+        PCG32 rng(11, 0);
+        for (uint32_t i = 0; i < options.cubes; i++) {
+            vec3 position(0.2f + (i % side + 0.5f) * spacing, -2.0f, -1.8f + (i / side + 0.5f) * spacing);
+            float size = spacing * (0.3f + 0.4f * rng.next_float());
+            mat4 transform = ScaleMatrix(vec3(size, size, size)) *
+                             RotationMatrix(2 * (float)M_PI * rng.next_float(), vec3(0, 1, 0)) * TranslateMatrix(position);
+            scene.add_instance(cube, transform);
+        }
+        scene.build_bvh();
+    }
+    if (!options.gltf.empty()) {
+        // 模型缩放后放在房间左侧的地面上
+        uint32_t material =
+            scene.add_material(Material::RoughMaterial(vec3(0.3f, 0.4f, 0.6f), vec3(0.4f, 0.4f, 0.4f), 50));
+        mat4 transform = ScaleMatrix(vec3(0.35f, 0.35f, 0.35f)) * TranslateMatrix(vec3(-1, -2, 0.5f));
+        scene.set_accel_cache(options.accel_cache);
+        scene.load_gltf(options.gltf, material, transform);
+        scene.build_bvh();
+    }
+    scene.set_light_sampling(options.exact_lights ? LIGHTS_EXACT : LIGHTS_BVH);
+    scene.set_light_samples(options.light_samples);
+    scene.get_scheduler().set_tile_size(options.tile_size);
+    scene.set_print_stats(false);
+
+    // 跳动的球以初始位置为最低点；对比一次完整构建BVH的用时
+    std::vector<vec3> sphere_bases;
+    for (const auto &sphere : scene.get_primitives().spheres)
+        sphere_bases.push_back(sphere.center);
+    if (options.bounce)
+        std::cout << "BVH build: " << scene.get_bvh().get_stats().build_ms << " ms" << std::endl;
+
+    std::vector<vec4> image;
+    double total_ms = 0;
+    uint64_t total_rays = 0;
+    for (uint32_t frame = 0; frame < options.frames; frame++) {
+        scene.render(image);
+        float ms = scene.get_frame_ms();
+        uint64_t rays = scene.get_frame_ray_count();
+        total_ms += ms;
+        total_rays += rays;
+        std::cout << "frame " << frame << ": " << ms << " ms, " << rays / std::max(ms, 1e-3f) * 1e-3 << " MRays/s";
+        if (options.progressive)
+            std::cout << ", spp " << scene.get_spp();
+        if (options.bounce && frame > 0) {
+            const BVHRefitStats &refit = scene.get_bvh().get_refit_stats();
+            std::cout << ", refit " << refit.refit_ms * 1000 << " us";
+            if (refit.full_rebuild)
+                std::cout << " (full rebuild)";
+            else if (refit.rebuilt_subtrees > 0)
+                std::cout << " (" << refit.rebuilt_subtrees << " subtrees rebuilt)";
+        }
+        std::cout << std::endl;
+
+        if (!options.output.empty() &&
+            !save_image(frame_path(options.output, frame, options.frames), image, options.width, options.height))
+            return 1;
+        if (options.animate != 0)
+            scene.animate(options.animate);
+        for (uint32_t i = 0; options.bounce && i < sphere_bases.size(); i++) {
+            float height = 1.5f * fabsf(sinf(0.3f * (frame + 1) * (i + 1)));
+            scene.move_sphere(i, sphere_bases[i] + vec3(0, height, 0));
+        }
+    }
+
+    std::cout << options.width << "x" << options.height << ", " << options.frames << " frames, "
+              << (options.packet_tracing ? "packet" : "scalar") << ": " << total_ms / options.frames << " ms/frame, "
+              << total_rays / std::max(total_ms, 1e-3) * 1e-3 << " MRays/s" << std::endl;
+    return 0;
+}